@@ -2,6 +2,119 @@
 
 int main(int argc, char **argv)
 {
+    // Command line options
+    const char *sweep_scene = NULL, *headless_scene = NULL, *poster_scene = NULL, *out_path = NULL;
+    enum ToneMap tone_map = TONE_MAP_NONE;
+    int image_width = 1920, image_height = 1080;
+    SweepAxis *axes = NULL;
+    int axes_length = 0, threads = 0;
+    bool bench = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--max-segment") && i + 1 < argc)
+        {
+            simulation.max_segment_length = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+        {
+            simulation.tolerance = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--scene") && i + 1 < argc)
+        {
+            editorState.scene_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--sweep") && i + 1 < argc)
+        {
+            sweep_scene = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--axis") && i + 1 < argc)
+        {
+            axes = (SweepAxis*)realloc(axes, sizeof(SweepAxis) * (axes_length + 1));
+            if (axes == NULL)
+            {
+                printf("Failed to allocate memory to sweep axes\n");
+                exit(1);
+            }
+            if (!parse_sweep_axis(argv[++i], &axes[axes_length]))
+            {
+                printf("Invalid axis %s, expected node:revps|length|position:from:to:steps\n", argv[i]);
+                return 1;
+            }
+            axes_length++;
+        }
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+        {
+            out_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--headless") && i + 1 < argc)
+        {
+            headless_scene = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--density") && i + 1 < argc)
+        {
+            if (!parse_tone_map(argv[++i], &tone_map))
+            {
+                printf("Invalid tone map %s, expected log, gamma or equalize\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--poster") && i + 1 < argc)
+        {
+            poster_scene = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &image_width, &image_height) != 2 || image_width < 1 || image_height < 1)
+            {
+                printf("Invalid size %s, expected <width>x<height>\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--cpu-trails"))
+        {
+            cpuTrails.enabled = true;
+        }
+        else if (!strcmp(argv[i], "--fade") && i + 1 < argc)
+        {   // Fading works on the trail pixels in memory
+            cpuTrails.half_life = atof(argv[++i]);
+            if (cpuTrails.half_life > 0) cpuTrails.enabled = true;
+        }
+        else if (!strcmp(argv[i], "--software"))
+        {
+            damage.enabled = true;
+        }
+        else if (!strcmp(argv[i], "--bench"))
+        {
+            bench = true;
+        }
+    }
+
+    // Batch and headless modes never open a window
+    if (bench)
+    {
+        free(axes);
+        return run_bench();
+    }
+    if (sweep_scene)
+    {
+        int status = run_sweep(sweep_scene, axes, axes_length, out_path ? out_path : ".", threads);
+        free(axes);
+        return status;
+    }
+    free(axes);
+    if (headless_scene)
+    {
+        return run_headless(headless_scene, out_path ? out_path : "spirograph.bmp", image_width, image_height, threads, tone_map);
+    }
+    if (poster_scene)
+    {
+        return run_poster(poster_scene, out_path ? out_path : "spirograph.bmp", image_width, image_height, threads);
+    }
+
     initialize_SDL();
     SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
 
@@ -31,23 +144,44 @@ int main(int argc, char **argv)
         // * Modes
         switch (mode) {
         case EDIT:
+            preview.update(&spirograph_base_node);
+            preview.draw();
             edit(&spirograph_base_node, dt);
 
             // Change mode to ANIMATE on space
             if (keyboardState.keydown(SDL_SCANCODE_SPACE) && editorState.edit_mode == EditorState::EDIT_MENU) 
             {
                 mode = ANIMATE;
+                damage.full = true;
                 spirograph_base_node.reset();
                 spirograph_base_node.update_trail_first_point();
+                trailPyramid.clear();
+                start_simulation(&spirograph_base_node); // The scene can only change in edit mode
             }
             break;
 
         case ANIMATE:
             editorState.edit_mode = EditorState::EDIT_MENU;
-            spirograph_base_node.draw_trail();
-            if (play) 
-            {   // Draw vectors and rotate when the animation is not paused
-                spirograph_base_node.rotate(dt);
+            update_view();
+            if (display.trails_lost)
+            {   // Drawn again from the trail history instead of simulating them again
+                redraw_trails(&compiledTree);
+                display.trails_lost = false;
+            }
+            if (play)
+            {   // Rotate when the animation is not paused
+                simulate(dt);
+                compiledTree.apply();
+                if (cpuTrails.half_life > 0)
+                {
+                    damage_restore(cpuTrails.framebuffer.decay(pow(0.5, dt / cpuTrails.half_life)));
+                    trailPyramid.fade(pow(0.5, dt / cpuTrails.half_life));
+                }
+            }
+            draw_trails(&compiledTree);
+            damage_composite();
+            if (play)
+            {   // Draw vectors when the animation is not paused
                 spirograph_base_node.draw(Spirograph::HIGHLIGHT);
             }
 
@@ -56,743 +190,4085 @@ int main(int argc, char **argv)
             {   // Pause/Unpause
                 play = !play;
             }
+            else if (keyboardState.keydown(SDL_SCANCODE_S))
+            {   // Save the trails drawn so far as an image
+                if (export_trails(&compiledTree, editorState.trails_path, TRAIL_EXPORT_SCALE)) printf("Saved trails to %s\n", editorState.trails_path);
+            }
+            else if (keyboardState.keydown(SDL_SCANCODE_F))
+            {   // Back to the unzoomed view
+                reset_view();
+            }
             else if (keyboardState.keydown(SDL_SCANCODE_R)) 
             {   // Change mode to EDIT
+                print_trail_history(&compiledTree);
                 mode = EDIT;
+                damage.full = true;
                 play = true;
                 spirograph_base_node.reset();
+                trailPyramid.clear();
+                reset_view();
             }
             
             break; 
         }
 
-        SDL_RenderPresent(renderer);
+        circleSprites.flush(renderer);
+        present();
     }
 
+    if (mode == ANIMATE) print_trail_history(&compiledTree);
+    if (trailBatch.points > 0)
+    {
+        printf("Trails: %lld anti-aliased points in %lld draw calls instead of %lld\n", trailBatch.points, trailBatch.draw_calls, 2 * trailBatch.points);
+    }
+
+    preview.free_members();
+    trailBatch.free_members();
+    circleSprites.free_members();
+    trailPyramid.free_members();
     spirograph_base_node.free_members();
+    compiledTree.free_members();
+    phasorEvaluator.free_members();
+    free(simulation.buffer);
     quit_SDL();
     return 0;
 }
 
-// * Edit function definitions
-void edit(Spirograph *spirograph_base_node, double dt)
+// * Simulation function definitions
+void start_simulation(Spirograph *root)
 {
-    static Spirograph *selected_node = NULL, *closest_node = NULL, *new_child = NULL;
-    spirograph_base_node->draw(Spirograph::UNHIGHLIGHT);
+    compiledTree.compile(root);
+    phasorEvaluator.compile(&compiledTree);
+    simulation.step = fixed_step(&compiledTree, &phasorEvaluator, simulation.max_segment_length, &simulation.closure_samples);
+    simulation.accumulator = 0;
+    simulation.samples = 0;
 
-    if (editorState.edit_mode == EditorState::EDIT_MENU) // * Edit the selected node
+    if (simulation.buffer == NULL)
     {
-        // Editing functions and editing states
-        bool editing_colour = false, editing_dirpos = false, editing_revps = false;
-        colour_palette(selected_node, &editing_colour);
-        change_rotation_speed(selected_node, &editing_revps, dt);
-        if (!editing_colour && !editing_revps)
-        {   // Editing states are used to prevent interference and only allow one thing to be edited at a time
-            edit_dirpos(selected_node, &editing_dirpos);
-            reselect_node(spirograph_base_node, closest_node, &selected_node, editing_dirpos);
-        }
-
-        // Toggle trail on key down
-        if (keyboardState.keydown(selected_node->toggle_trail_key))
+        simulation.buffer = (Vec2Float*)malloc(sizeof(Vec2Float) * MAX_SUBSTEPS);
+        if (simulation.buffer == NULL)
         {
-            selected_node->trail_on = !(selected_node->trail_on);
+            printf("Failed to allocate memory to the simulation buffer\n");
+            exit(1);
         }
+    }
 
-        // Delete node on key down
-        if (keyboardState.keydown(selected_node->delete_node_key) && selected_node != spirograph_base_node)
-        {
-            Spirograph *old_parent = selected_node->parent;
-            old_parent->remove_child(selected_node);
-            selected_node = old_parent;
-
-            if (selected_node->is_root && spirograph_base_node->children_length == 0)
-            {   // Create new root after an old root was deleted
-                editorState.creating_first = true;
-                editorState.edit_mode = EditorState::SET_CHILD_POSITION;
-            }
-        }
+    // Trails start at their tip at t = 0
+    for (int i = 0; i < compiledTree.nodes_length; i++)
+    {
+        if (compiledTree.trails[i]) compiledTree.trails[i]->new_point(phasorEvaluator.tip(i, 0), 0);
+    }
 
-        // Reset spirograph
-        if (keyboardState.keydown(selected_node->reset_key) && !editorState.creating_first && spirograph_base_node->children_length > 0)
-        {
-            // Remove all the roots from the base node and set the selected node to the base node
-            spirograph_base_node->clear_children();
-            selected_node = spirograph_base_node;
+    return;
+}
 
-            // Create a new root after old root was deleted
-            editorState.creating_first = true;
-            editorState.edit_mode = EditorState::SET_CHILD_POSITION;
-        }
+double fixed_step(CompiledTree *tree, PhasorEvaluator *evaluator, float max_segment_length, long long *closure_samples)
+{
+    // Step short enough that no trail moves further than the maximum segment length in one step
+    float max_speed = 0;
+    for (int i = 0; i < tree->nodes_length; i++)
+    {
+        float speed = evaluator->max_speed(i);
+        if (tree->trail_on[i] && speed > max_speed) max_speed = speed;
+    }
+    double step = (max_speed > 0) ? max_segment_length / max_speed : 1 / 60.0;
 
-        // Todo: test
-        // Switch modes when holding left CTRL
-        if (keyboardState.keystates[SDL_SCANCODE_LCTRL])
-        {
-            editorState.edit_mode = EditorState::SET_CHILD_POSITION;
-        }
+    // Shrink the step so the curve closes exactly on a step
+    double period = evaluator->closure_period(tree);
+    if (isinf(period))
+    {
+        *closure_samples = -1;
     }
-    else if (editorState.edit_mode == EditorState::SET_CHILD_POSITION) // * Set position of new node
+    else
     {
-        // Get closest node to cursor
-        float distance;
-        Vec2Float orthproj;
-        node_near_cursor_orthproj(spirograph_base_node, &selected_node, &distance, &orthproj);
-
-        // Don't consider the base node
-        if (selected_node == spirograph_base_node && spirograph_base_node->children_length > 0)
-        {
-            selected_node = spirograph_base_node->children[0];
-        }
-        Vec2Float new_pos = {selected_node->position_initial.x + orthproj.x, selected_node->position_initial.y + orthproj.y};
+        *closure_samples = ceil(period / step);
+        if (*closure_samples > 0) step = period / *closure_samples;
+    }
 
-        // Draw segments
-        selected_node->draw_direction(Spirograph::HIGHLIGHT);
-        selected_node->draw_head(Spirograph::HIGHLIGHT);
-        SDL_SetRenderDrawColor(renderer, YELLOW);
-        SDL_RenderFillCircle(renderer, new_pos.x, new_pos.y, 3);
-        drawLine(renderer, {ORANGE}, MouseState.pos.x, MouseState.pos.y, new_pos.x, new_pos.y);
+    return step;
+}
 
-        // Mouse events
-        if (MouseState.left_down)
-        {   // Add new child and switch to set direction mode
-            new_child = new Spirograph(new_pos, {(float)MouseState.pos.x, (float)MouseState.pos.y});
-            selected_node->add_child(new_child);
-            new_child->direction_initial = new_child->direction = {MouseState.pos.x - new_child->position_initial.x, MouseState.pos.y - new_child->position_initial.y};
-            editorState.edit_mode = EditorState::SET_CHILD_DIRECTION;
+void simulate(double dt)
+{
+    // Run as many whole steps as the elapsed time allows so the samples never depend on the frame rate
+    simulation.accumulator += dt;
+    int substeps = simulation.accumulator / simulation.step;
+    if (substeps > MAX_SUBSTEPS)
+    {   // Drop the backlog instead of falling further behind, the animation slows down but draws the same curve
+        substeps = MAX_SUBSTEPS;
+        simulation.accumulator = 0;
+    }
+    else
+    {
+        simulation.accumulator -= substeps * simulation.step;
+    }
 
-            if (selected_node == spirograph_base_node)
+    // Sample every trail for the new steps in one batch per node. Once the curve has closed only the arms move on,
+    // unless trails fade, then they are drawn over again for as long as the animation runs
+    int trail_steps = substeps;
+    bool closes = simulation.closure_samples >= 0 && cpuTrails.half_life <= 0;
+    if (closes && simulation.samples + trail_steps > simulation.closure_samples)
+    {
+        trail_steps = (simulation.samples < simulation.closure_samples) ? simulation.closure_samples - simulation.samples : 0;
+    }
+    if (trail_steps > 0)
+    {
+        for (int i = 0; i < compiledTree.nodes_length; i++)
+        {
+            if (!compiledTree.trails[i]) continue;
+            phasorEvaluator.tips(i, 0, simulation.step, simulation.samples + 1, trail_steps, simulation.buffer);
+            for (int k = 0; k < trail_steps; k++)
             {
-                editorState.creating_first = false;
+                compiledTree.trails[i]->new_point(simulation.buffer[k], (simulation.samples + 1 + k) * simulation.step);
             }
         }
+    }
+    simulation.samples += substeps;
 
-        // Todo: test
-        // Switch modes when left CTRL up
-        if (keyboardState.keyup(SDL_SCANCODE_LCTRL))
+    // Only the final state of the arms is drawn
+    compiledTree.seek(simulation.samples * simulation.step);
+
+    return;
+}
+
+void generate_curve(PhasorEvaluator *evaluator, int node, double dt, long long count, Vec2Float *out, int threads)
+{
+    // Tips of node at t = k * dt for k in [0, count), split into one time slice per thread.
+    // Slices start on a kernel block so every sample is computed exactly as a single threaded run would
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    long long blocks = (count + PHASOR_BLOCK - 1) / PHASOR_BLOCK;
+    const long long min_slice_blocks = 16; // Not worth a thread below this
+    if (threads > blocks / min_slice_blocks) threads = blocks / min_slice_blocks;
+    if (threads < 1) threads = 1;
+
+    auto slice = [evaluator, node, dt, count, out](long long first, long long last) -> void {
+        const long long chunk = 1LL << 20; // Keeps sample counts within the kernel's int range
+        for (long long k = first; k < last; k += chunk)
         {
-            editorState.edit_mode = EditorState::EDIT_MENU;
+            int n = (last - k < chunk) ? last - k : chunk;
+            evaluator->tips(node, 0, dt, k, n, out + k);
         }
+        return;
+    };
+
+    std::thread *workers = new std::thread[threads - 1];
+    long long blocks_per_thread = blocks / threads, extra_blocks = blocks % threads;
+    long long first = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        long long last = first + (blocks_per_thread + (i < extra_blocks)) * PHASOR_BLOCK;
+        if (last > count) last = count;
+
+        // The calling thread takes the last slice
+        if (i < threads - 1) workers[i] = std::thread(slice, first, last);
+        else slice(first, last);
+        first = last;
     }
-    else if (editorState.edit_mode == EditorState::SET_CHILD_DIRECTION) // * Set direction of new node
+    for (int i = 0; i < threads - 1; i++)
     {
-        // Fix direction vector to cursor and draw
-        new_child->direction_initial = new_child->direction = {MouseState.pos.x - new_child->position_initial.x, MouseState.pos.y - new_child->position_initial.y};
-        selected_node->draw_direction(Spirograph::HIGHLIGHT);
-        selected_node->draw_head(Spirograph::HIGHLIGHT);
+        workers[i].join();
+    }
+    delete[] workers;
 
-        // Mouse events
-        if (MouseState.left_up)
+    return;
+}
+
+long long adaptive_curve(PhasorEvaluator *evaluator, int node, double step, long long first, long long count, float tolerance, Vec2Float **points, long long *capacity)
+{
+    // Tips of node over the steps [first, first + count) into a growing array, returns how many. Each step is halved
+    // until its chords are within half the tolerance of the curve, then runs of segments on straight stretches are
+    // merged while they stay within the other half. The points only depend on the range, never on the frame rate
+    long long length = refine_curve(evaluator, node, step, first, count, tolerance, points, capacity);
+
+    return merge_curve(*points, length, tolerance);
+}
+
+long long refine_curve(PhasorEvaluator *evaluator, int node, double step, long long first, long long count, float tolerance, Vec2Float **points, long long *capacity)
+{
+    // The halving half of adaptive_curve. Every step is refined on its own, so ranges refined apart and joined on
+    // their shared point are the same as the whole range refined at once. Tips come from the analytic evaluator,
+    // so halving a step is exact however deep it goes
+    long long length = 0;
+    auto push = [points, capacity, &length](Vec2Float point) -> void {
+        if (length == *capacity)
         {
-            MouseState.left_up = false;
-            selected_node = new_child;
-            if (!new_child->is_root)
+            *capacity = *capacity ? 2 * *capacity : 4096;
+            *points = (Vec2Float*)realloc(*points, sizeof(Vec2Float) * *capacity);
+            if (*points == NULL)
             {
-                new_child->trail_on = true;
+                printf("Failed to allocate memory to adaptive curve samples\n");
+                exit(1);
             }
+        }
+        (*points)[length++] = point;
+        return;
+    };
+    float half = tolerance / 2;
 
-            // Change mode
-            if (keyboardState.keystates[SDL_SCANCODE_LCTRL])
+    // Depth first, the stack holds the ends of the pieces of the step still to do
+    struct {double t; Vec2Float p; int depth;} stack[ADAPTIVE_MAX_DEPTH + 1];
+    push(evaluator->tip(node, first * step));
+    for (long long k = first; k < first + count; k++)
+    {
+        double ta = k * step;
+        Vec2Float pa = (*points)[length - 1];
+        int top = 0;
+        stack[top++] = {(k + 1) * step, evaluator->tip(node, (k + 1) * step), 0};
+        while (top > 0)
+        {
+            double tb = stack[top - 1].t, tm = (ta + tb) / 2;
+            Vec2Float pb = stack[top - 1].p, pm = evaluator->tip(node, tm);
+            int depth = stack[top - 1].depth;
+            bool split = false;
+            if (depth < ADAPTIVE_MAX_DEPTH)
             {
-                editorState.edit_mode = EditorState::SET_CHILD_POSITION;
+                split = segment_distance(pm, pa, pb) > half;
+                if (!split && depth == 0)
+                {   // A whole step could hide a small loop that passes back through its chord at the midpoint
+                    split = segment_distance(evaluator->tip(node, (3 * ta + tb) / 4), pa, pb) > half || segment_distance(evaluator->tip(node, (ta + 3 * tb) / 4), pa, pb) > half;
+                }
             }
-            else
+            if (split)
             {
-                editorState.edit_mode = EditorState::EDIT_MENU;
+                stack[top - 1].depth = depth + 1;
+                stack[top++] = {tm, pm, depth + 1};
+                continue;
             }
-        }
-        else if (MouseState.right_down)
-        {
-            MouseState.right_down = false;
-            editorState.edit_mode = EditorState::SET_CHILD_POSITION;
+            push(pb);
+            ta = tb;
+            pa = pb;
+            top--;
         }
     }
 
-    return;
+    return length;
 }
 
-void reselect_node(Spirograph *spirograph_base_node, Spirograph *closest_node, Spirograph **selected_node, bool editing_dirpos)
+long long merge_curve(Vec2Float *p, long long length, float tolerance)
 {
-    // Get closest node to cursor
-    float node_distance;
-    Vec2Float orthproj;
-    node_near_cursor_orthproj(spirograph_base_node, &closest_node, &node_distance, &orthproj);
-
-    // Don't consider the base node
-    if (closest_node == spirograph_base_node)
+    // The merging half of adaptive_curve, in place, returns how many points are kept. A point is dropped while the
+    // chord from the last kept point past it stays within half the tolerance of every point in between. Kept points
+    // are moved down in place, never over a point still to be checked
+    float half = tolerance / 2;
+    long long kept = 1, anchor = 0;
+    for (long long j = 2; j < length; j++)
     {
-        if (spirograph_base_node->children_length > 0)
+        bool straight = j - anchor <= ADAPTIVE_MAX_MERGE;
+        for (long long m = anchor + 1; m < j && straight; m++)
         {
-            closest_node = spirograph_base_node->children[0];
+            straight = segment_distance(p[m], p[anchor], p[j]) <= half;
         }
-        else
+        if (!straight)
         {
-            editorState.edit_mode = EditorState::SET_CHILD_POSITION;
-            return;
+            p[kept++] = p[j - 1];
+            anchor = j - 1;
         }
     }
+    if (length > 1) p[kept++] = p[length - 1];
 
-    // Draw closest and selected node
-    if (!editing_dirpos)
-    {
-        closest_node->draw_direction(Spirograph::LIGHT_HIGHLIGHT);
-        closest_node->draw_head(Spirograph::UNHIGHLIGHT);
-    }
-    (*selected_node)->draw_direction(Spirograph::HIGHLIGHT);
-    (*selected_node)->draw_head(Spirograph::HIGHLIGHT);
-    (*selected_node)->draw_base(Spirograph::HIGHLIGHT);
-    
-    // Mouse events
-    if (MouseState.left_down && !editing_dirpos)
-    {   // Select closest node on click
-        MouseState.left_down = false;
-        *selected_node = closest_node;
-    }
-
-    return;
+    return kept;
 }
 
-void edit_dirpos(Spirograph *selected_node, bool *editing)
+long long threaded_adaptive_curve(PhasorEvaluator *evaluator, int node, double step, long long count, float tolerance, Vec2Float **points, long long *capacity, int threads)
 {
-    // Holding and hovering base and head states
-    static bool holding_head, holding_base;
-    Vec2Float head_position = {selected_node->position_initial.x + selected_node->direction_initial.x, selected_node->position_initial.y + selected_node->direction_initial.y};
-    const bool hovering_base = pow(MouseState.pos.x - selected_node->position_initial.x, 2) + pow(MouseState.pos.y - selected_node->position_initial.y, 2) <= pow(selected_node->hover_radius, 2);
-    const bool hovering_head = pow(MouseState.pos.x - head_position.x, 2) + pow(MouseState.pos.y - head_position.y, 2) <= pow(selected_node->hover_radius, 2);
+    // adaptive_curve over the steps [0, count), refined in one range per thread. The ranges are joined in order
+    // and merged as one, so the points are the same as adaptive_curve's for any number of threads
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads > count) threads = count;
+    if (threads < 1) threads = 1;
+
+    Vec2Float **runs = new Vec2Float*[threads]();
+    long long *runs_length = new long long[threads](), *runs_capacity = new long long[threads]();
+    auto run = [&](int j) -> void {
+        long long first = count * j / threads, last = count * (j + 1) / threads;
+        runs_length[j] = refine_curve(evaluator, node, step, first, last - first, tolerance, &runs[j], &runs_capacity[j]);
+        return;
+    };
 
-    // Update holding and hovering base and head states on mouse and keyboard events        
-    if (keyboardState.keystates[selected_node->change_head_key] || (hovering_head && MouseState.left_down))
+    std::thread *workers = new std::thread[threads - 1];
+    for (int j = 0; j < threads - 1; j++)
     {
-        holding_head = true;
+        workers[j] = std::thread(run, j);
     }
-    else if (!MouseState.left_down)
+    run(threads - 1);
+    for (int j = 0; j < threads - 1; j++)
     {
-        holding_head = false;
+        workers[j].join();
     }
-    
-    if (keyboardState.keystates[selected_node->change_base_key] || (hovering_base && !selected_node->is_root && MouseState.left_down))
+    delete[] workers;
+
+    // Every range starts on the point the one before it ended on, which is only kept once
+    long long length = 1 - threads;
+    for (int j = 0; j < threads; j++)
     {
-        holding_base = true;
+        length += runs_length[j];
     }
-    else if (!MouseState.left_down)
+    if (length > *capacity)
     {
-        holding_base = false;
+        *capacity = length;
+        *points = (Vec2Float*)realloc(*points, sizeof(Vec2Float) * *capacity);
+        if (*points == NULL)
+        {
+            printf("Failed to allocate memory to adaptive curve samples\n");
+            exit(1);
+        }
+    }
+    length = 0;
+    for (int j = 0; j < threads; j++)
+    {
+        long long skip = (j > 0) ? 1 : 0;
+        memcpy(*points + length, runs[j] + skip, sizeof(Vec2Float) * (runs_length[j] - skip));
+        length += runs_length[j] - skip;
+        free(runs[j]);
+    }
+    delete[] runs;
+    delete[] runs_length;
+    delete[] runs_capacity;
+
+    return merge_curve(*points, length, tolerance);
+}
+
+// * Sweep function definitions
+bool parse_sweep_axis(const char *text, SweepAxis *axis)
+{
+    // node:parameter:from:to:steps
+    char parameter[16];
+    if (sscanf(text, "%d:%15[^:]:%f:%f:%d", &axis->node, parameter, &axis->from, &axis->to, &axis->steps) != 5 || axis->steps < 1 || axis->node < 1)
+    {
+        return false;
+    }
+
+    if (!strcmp(parameter, "revps")) axis->parameter = SWEEP_REVPS;
+    else if (!strcmp(parameter, "length")) axis->parameter = SWEEP_LENGTH;
+    else if (!strcmp(parameter, "position")) axis->parameter = SWEEP_POSITION_ON_PARENT;
+    else return false;
+
+    return true;
+}
+
+int run_sweep(const char *scene_path, SweepAxis *axes, int axes_length, const char *out_dir, int threads)
+{
+    CompiledTree base;
+    if (!base.load(scene_path)) return 1;
+
+    long variants = 1;
+    for (int a = 0; a < axes_length; a++)
+    {
+        if (axes[a].node >= base.nodes_length)
+        {
+            printf("Axis node %d is out of range, the scene has nodes 1 to %d\n", axes[a].node, base.nodes_length - 1);
+            base.free_members();
+            return 1;
+        }
+        variants *= axes[a].steps;
+    }
+
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads > variants) threads = variants;
+    if (threads < 1) threads = 1;
+    printf("Rendering %ld variants on %d threads\n", variants, threads);
+
+    std::atomic<long> next_variant(0);
+    std::atomic<int> failures(0);
+    auto worker = [&]() -> void {
+        // Each worker keeps its own copy of the layout and buffers and only rewrites the swept values
+        CompiledTree tree;
+        PhasorEvaluator evaluator;
+        Vec2Float *curve = NULL;
+        long curve_capacity = 0;
+
+        for (long variant = next_variant++; variant < variants; variant = next_variant++)
+        {
+            tree.copy(&base);
+
+            // Mixed radix decode of the variant index into one step per axis
+            char description[256] = "";
+            long index = variant;
+            for (int a = 0; a < axes_length; a++)
+            {
+                int step = index % axes[a].steps;
+                index /= axes[a].steps;
+                float value = (axes[a].steps > 1) ? axes[a].from + (axes[a].to - axes[a].from) * step / (axes[a].steps - 1) : axes[a].from;
+                int n = axes[a].node;
+
+                const char *name = "revps";
+                if (axes[a].parameter == SWEEP_REVPS)
+                {
+                    tree.revps[n] = value;
+                }
+                else if (axes[a].parameter == SWEEP_LENGTH)
+                {
+                    name = "length";
+                    float length = sqrt(tree.direction_initial_x[n] * tree.direction_initial_x[n] + tree.direction_initial_y[n] * tree.direction_initial_y[n]);
+                    if (length > 0)
+                    {
+                        tree.direction_initial_x[n] *= value / length;
+                        tree.direction_initial_y[n] *= value / length;
+                    }
+                }
+                else
+                {
+                    name = "position";
+                    tree.position_on_parent[n] = value;
+                }
+                int used = strlen(description);
+                snprintf(description + used, sizeof(description) - used, " node %d %s=%g", n, name, value);
+            }
+            tree.seek(0);
+            evaluator.compile(&tree);
+
+            // One closed period, or a fixed duration when the curve never closes
+            long long closure_samples;
+            double step = fixed_step(&tree, &evaluator, simulation.max_segment_length, &closure_samples);
+            long long samples = (closure_samples >= 0) ? closure_samples + 1 : (long long)(SWEEP_DURATION / step) + 1;
+            char truncated[128] = "";
+            if (samples > SWEEP_MAX_SAMPLES)
+            {
+                // Cut short rather than run out of memory, and say so in the file as well as here
+                snprintf(truncated, sizeof(truncated), " truncated to %d of %lld samples", SWEEP_MAX_SAMPLES, samples);
+                printf("Variant %05ld%s is%s\n", variant, description, truncated);
+                samples = SWEEP_MAX_SAMPLES;
+            }
+            if (samples > curve_capacity)
+            {
+                curve_capacity = samples;
+                curve = (Vec2Float*)realloc(curve, sizeof(Vec2Float) * curve_capacity);
+                if (curve == NULL)
+                {
+                    printf("Failed to allocate memory to the sweep curve\n");
+                    exit(1);
+                }
+            }
+
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/variant_%05ld.csv", out_dir, variant);
+            FILE *file = fopen(path, "w");
+            if (file == NULL)
+            {
+                printf("Failed to open %s for writing\n", path);
+                failures++;
+                continue;
+            }
+            fprintf(file, "#%s%s\nnode,x,y\n", description, truncated);
+            for (int i = 0; i < tree.nodes_length; i++)
+            {
+                if (!tree.trail_on[i]) continue;
+                generate_curve(&evaluator, i, step, samples, curve, 1); // Variants already keep every core busy
+                for (long long k = 0; k < samples; k++)
+                {
+                    fprintf(file, "%d,%.3f,%.3f\n", i, curve[k].x, curve[k].y);
+                }
+            }
+            fclose(file);
+        }
+
+        tree.free_members();
+        evaluator.free_members();
+        free(curve);
+        return;
+    };
+
+    std::thread *workers = new std::thread[threads];
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i] = std::thread(worker);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].join();
+    }
+    delete[] workers;
+    base.free_members();
+
+    return failures ? 1 : 0;
+}
+
+// * Headless function definitions
+bool parse_tone_map(const char *text, enum ToneMap *tone_map)
+{
+    if (!strcmp(text, "log")) *tone_map = TONE_MAP_LOG;
+    else if (!strcmp(text, "gamma")) *tone_map = TONE_MAP_GAMMA;
+    else if (!strcmp(text, "equalize")) *tone_map = TONE_MAP_EQUALIZE;
+    else return false;
+
+    return true;
+}
+
+int run_headless(const char *scene_path, const char *out_path, int width, int height, int threads, enum ToneMap tone_map)
+{
+    CompiledTree tree;
+    PhasorEvaluator evaluator;
+    if (!tree.load(scene_path)) return 1;
+    evaluator.compile(&tree);
+
+    // Fit the canvas the scene was made on into the image
+    float scale_x = width / (float)tree.canvas_width, scale_y = height / (float)tree.canvas_height;
+    float scale = (scale_x < scale_y) ? scale_x : scale_y;
+    float offset_x = (width - tree.canvas_width * scale) / 2, offset_y = (height - tree.canvas_height * scale) / 2;
+
+    // Segment length is limited in image pixels. Adaptive sampling starts from longer steps and refines them
+    // until the segments are within the tolerance of the curve in image pixels
+    bool adaptive = simulation.tolerance > 0;
+    long long closure_samples;
+    double step = fixed_step(&tree, &evaluator, (adaptive ? ADAPTIVE_BASE_LENGTH : simulation.max_segment_length) / scale, &closure_samples);
+    long long samples = (closure_samples >= 0) ? closure_samples + 1 : (long long)(SWEEP_DURATION / step) + 1;
+    long long curve_capacity = adaptive ? 0 : samples, segments = 0;
+    Vec2Float *curve = adaptive ? NULL : (Vec2Float*)malloc(sizeof(Vec2Float) * samples);
+    if (!adaptive && curve == NULL)
+    {
+        printf("Failed to allocate memory to %lld curve samples\n", samples);
+        exit(1);
+    }
+    auto sample_trail = [&](int i) -> long long {
+        long long n = samples;
+        if (adaptive) n = threaded_adaptive_curve(&evaluator, i, step, samples - 1, simulation.tolerance / scale, &curve, &curve_capacity, threads);
+        else generate_curve(&evaluator, i, step, samples, curve, threads);
+        for (long long k = 0; k < n; k++)
+        {
+            curve[k] = {offset_x + curve[k].x * scale, offset_y + curve[k].y * scale};
+        }
+        segments += n - 1;
+        return n;
+    };
+
+    Framebuffer framebuffer;
+    if (tone_map == TONE_MAP_NONE)
+    {
+        framebuffer.create(width, height);
+        framebuffer.clear({BLACK});
+        for (int i = 0; i < tree.nodes_length; i++)
+        {
+            if (!tree.trail_on[i]) continue;
+            long long points = sample_trail(i);
+            float stroke = tree.trail_width[i] * scale;
+            for (long long k = 1; k < points; k++)
+            {
+                if (stroke > 1) framebuffer.draw_stroke(tree.trail_colour[i], curve[k - 1].x, curve[k - 1].y, curve[k].x, curve[k].y, stroke, (k > 1) ? &curve[k - 2] : NULL);
+                else framebuffer.draw_line(tree.trail_colour[i], curve[k - 1].x, curve[k - 1].y, curve[k].x, curve[k].y);
+            }
+        }
+    }
+    else
+    {
+        // Every thread sums its slice of each trail into its own density buffer, then the buffers are added up
+        int accumulators = (threads > 0) ? threads : std::thread::hardware_concurrency();
+        size_t buffer_bytes = sizeof(float) * 4 * (size_t)width * height;
+        for (int i = 0; i < tree.nodes_length; i++)
+        {
+            // Strokes keep track of what each pass covered
+            if (tree.trail_on[i] && tree.trail_width[i] * scale > 1)
+            {
+                buffer_bytes += (sizeof(double) + sizeof(float)) * (size_t)width * height;
+                break;
+            }
+        }
+        if ((size_t)accumulators > DENSITY_MAX_MEMORY / buffer_bytes) accumulators = DENSITY_MAX_MEMORY / buffer_bytes;
+        if (accumulators < 1) accumulators = 1;
+        DensityBuffer *buffers = new DensityBuffer[accumulators];
+        for (int j = 0; j < accumulators; j++)
+        {
+            buffers[j].create(width, height);
+            buffers[j].clear();
+        }
+
+        std::thread *workers = new std::thread[accumulators - 1];
+        for (int i = 0; i < tree.nodes_length; i++)
+        {
+            if (!tree.trail_on[i]) continue;
+            long long points = sample_trail(i);
+            float stroke = tree.trail_width[i] * scale;
+            auto slice = [&, i, points](int j) -> void {
+                long long first = 1 + (points - 1) * j / accumulators, last = 1 + (points - 1) * (j + 1) / accumulators;
+                long long from = first, wrap = points;
+                if (stroke > 1)
+                {
+                    // The pass the slice starts in began in the slice before, so the last stroke width of it is
+                    // recorded again to not count it twice. A closed trail ends where it starts, so the first slice
+                    // carries on from the end of the curve
+                    float behind = 0;
+                    while (from > 1 && behind <= stroke + 1)
+                    {
+                        from--;
+                        behind += hypotf(curve[from].x - curve[from - 1].x, curve[from].y - curve[from - 1].y);
+                    }
+                    while (closure_samples >= 0 && from == 1 && wrap > 2 && behind <= stroke + 1)
+                    {
+                        wrap--;
+                        behind += hypotf(curve[wrap].x - curve[wrap - 1].x, curve[wrap].y - curve[wrap - 1].y);
+                    }
+                }
+                for (long long k = wrap; k < points; k++)
+                {
+                    buffers[j].draw_stroke(tree.trail_colour[i], curve[k - 1].x, curve[k - 1].y, curve[k].x, curve[k].y, stroke, (k > wrap) ? &curve[k - 2] : NULL, false);
+                }
+                for (long long k = from; k < last; k++)
+                {
+                    const Vec2Float *previous = (k > from) ? &curve[k - 2] : (wrap < points) ? &curve[points - 2] : NULL;
+                    if (stroke > 1) buffers[j].draw_stroke(tree.trail_colour[i], curve[k - 1].x, curve[k - 1].y, curve[k].x, curve[k].y, stroke, previous, k >= first);
+                    else buffers[j].draw_line(tree.trail_colour[i], curve[k - 1].x, curve[k - 1].y, curve[k].x, curve[k].y);
+                }
+                return;
+            };
+            for (int j = 0; j < accumulators - 1; j++)
+            {
+                workers[j] = std::thread(slice, j);
+            }
+            slice(accumulators - 1);
+            for (int j = 0; j < accumulators - 1; j++)
+            {
+                workers[j].join();
+            }
+        }
+        delete[] workers;
+
+        for (int j = 1; j < accumulators; j++)
+        {
+            buffers[0].add(&buffers[j]);
+            buffers[j].free_members();
+        }
+        buffers[0].tone_map(tone_map, &framebuffer);
+        buffers[0].free_members();
+        delete[] buffers;
+    }
+
+    bool saved = framebuffer.save_bmp(out_path);
+    if (saved && adaptive)
+    {   // Against the segments of uniform steps
+        long long uniform_samples;
+        double uniform_step = fixed_step(&tree, &evaluator, simulation.max_segment_length / scale, &uniform_samples);
+        if (uniform_samples < 0) uniform_samples = SWEEP_DURATION / uniform_step;
+        int trails = 0;
+        for (int i = 0; i < tree.nodes_length; i++) trails += tree.trail_on[i];
+        printf("Rendered %lld adaptive segments to %s instead of %lld uniform ones\n", segments, out_path, uniform_samples * trails);
+    }
+    else if (saved) printf("Rendered %lld samples per trail to %s\n", samples, out_path);
+
+    framebuffer.free_members();
+    free(curve);
+    tree.free_members();
+    evaluator.free_members();
+    return saved ? 0 : 1;
+}
+
+int run_poster(const char *scene_path, const char *out_path, int width, int height, int threads)
+{
+    // Like run_headless for images too big to hold in memory: the image is rasterized one row of tiles at a
+    // time, every tile on its own thread, and each finished row is appended to a top-down BMP file
+    CompiledTree tree;
+    PhasorEvaluator evaluator;
+    if (!tree.load(scene_path)) return 1;
+    evaluator.compile(&tree);
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads < 1) threads = 1;
+
+    float scale_x = width / (float)tree.canvas_width, scale_y = height / (float)tree.canvas_height;
+    float scale = (scale_x < scale_y) ? scale_x : scale_y;
+    float offset_x = (width - tree.canvas_width * scale) / 2, offset_y = (height - tree.canvas_height * scale) / 2;
+
+    long long closure_samples;
+    double step = fixed_step(&tree, &evaluator, simulation.max_segment_length / scale, &closure_samples);
+    long long samples = (closure_samples >= 0) ? closure_samples + 1 : (long long)(SWEEP_DURATION / step) + 1;
+    long long chunks = (samples - 1 + POSTER_CHUNK - 1) / POSTER_CHUNK;
+
+    int trails_length = 0;
+    int *trails = (int*)malloc(sizeof(int) * tree.nodes_length);
+    float *chunk_top = (float*)malloc(sizeof(float) * (tree.nodes_length * chunks + 1));
+    float *chunk_bottom = (float*)malloc(sizeof(float) * (tree.nodes_length * chunks + 1));
+    if (trails == NULL || chunk_top == NULL || chunk_bottom == NULL)
+    {
+        printf("Failed to allocate memory to the poster chunk bounds\n");
+        exit(1);
+    }
+    for (int i = 0; i < tree.nodes_length; i++)
+    {
+        if (tree.trail_on[i]) trails[trails_length++] = i;
+    }
+
+    // Chunk c holds the segments ending at samples c * POSTER_CHUNK + 1 to (c + 1) * POSTER_CHUNK, evaluated
+    // from one sample earlier after the first chunk so the first segment knows its predecessor for the join
+    auto evaluate_chunk = [&](int trail, long long chunk, Vec2Float *points) -> int {
+        long long first = chunk * POSTER_CHUNK - (chunk > 0);
+        int n = (samples - first < POSTER_CHUNK + 2) ? samples - first : POSTER_CHUNK + 1 + (chunk > 0);
+        evaluator.tips(trails[trail], 0, step, first, n, points);
+        for (int k = 0; k < n; k++)
+        {
+            points[k] = {offset_x + points[k].x * scale, offset_y + points[k].y * scale};
+        }
+        return n;
+    };
+
+    // Vertical extent of every chunk, so each tile row only evaluates the chunks that reach it
+    std::atomic<long long> next_chunk(0);
+    auto bound_chunks = [&]() -> void {
+        Vec2Float *points = (Vec2Float*)malloc(sizeof(Vec2Float) * (POSTER_CHUNK + 2));
+        if (points == NULL)
+        {
+            printf("Failed to allocate memory to poster samples\n");
+            exit(1);
+        }
+        for (long long index = next_chunk++; index < trails_length * chunks; index = next_chunk++)
+        {
+            int n = evaluate_chunk(index / chunks, index % chunks, points);
+            float top = points[0].y, bottom = points[0].y;
+            for (int k = 1; k < n; k++)
+            {
+                top = fminf(top, points[k].y);
+                bottom = fmaxf(bottom, points[k].y);
+            }
+            chunk_top[index] = top;
+            chunk_bottom[index] = bottom;
+        }
+        free(points);
+        return;
+    };
+    std::thread *workers = new std::thread[threads - 1];
+    for (int i = 0; i < threads - 1; i++)
+    {
+        workers[i] = std::thread(bound_chunks);
+    }
+    bound_chunks();
+    for (int i = 0; i < threads - 1; i++)
+    {
+        workers[i].join();
+    }
+
+    FILE *file = fopen(out_path, "wb");
+    if (file == NULL || !write_bmp_header(file, width, height))
+    {
+        printf("Failed to write %s\n", out_path);
+        if (file) fclose(file);
+        delete[] workers;
+        free(trails);
+        free(chunk_top);
+        free(chunk_bottom);
+        tree.free_members();
+        evaluator.free_members();
+        return 1;
+    }
+
+    // Per tile row: the segments reaching it, binned per tile in drawing order, and the finished BGR rows
+    int tiles_x = (width + POSTER_TILE_SIZE - 1) / POSTER_TILE_SIZE;
+    long pitch = ((long)width * 3 + 3) & ~3L;
+    Uint8 *rows = (Uint8*)calloc(pitch, POSTER_TILE_SIZE);
+    int *tile_start = (int*)malloc(sizeof(int) * (tiles_x + 1));
+    Vec2Float *points = (Vec2Float*)malloc(sizeof(Vec2Float) * (POSTER_CHUNK + 2));
+    PosterSegment *segments = NULL;
+    int *binned = NULL;
+    long long segments_length = 0, segments_capacity = 0, binned_capacity = 0;
+    if (rows == NULL || tile_start == NULL || points == NULL)
+    {
+        printf("Failed to allocate memory to a %dx%d tile row\n", width, POSTER_TILE_SIZE);
+        exit(1);
+    }
+
+    // Wu lines touch one pixel beyond the segment's bounding box, strokes half their width more
+    auto reach = [&](int node) -> float {return (tree.trail_width[node] * scale > 1) ? 2 + tree.trail_width[node] * scale / 2 : 2;};
+    auto first_tile = [](float x) -> int {return fmaxf(0, floorf(x)) / POSTER_TILE_SIZE;};
+    auto last_tile = [tiles_x](float x) -> int {int tile = fmaxf(0, floorf(x)) / POSTER_TILE_SIZE; return (tile < tiles_x) ? tile : tiles_x - 1;};
+
+    long long drawn = 0;
+    for (int band_top = 0; band_top < height; band_top += POSTER_TILE_SIZE)
+    {
+        int band_height = (height - band_top < POSTER_TILE_SIZE) ? height - band_top : POSTER_TILE_SIZE;
+
+        // Gather the segments reaching this tile row
+        segments_length = 0;
+        for (int t = 0; t < trails_length; t++)
+        {
+            float margin = reach(trails[t]);
+            for (long long c = 0; c < chunks; c++)
+            {
+                if (chunk_bottom[t * chunks + c] + margin < band_top || chunk_top[t * chunks + c] - margin >= band_top + band_height) continue;
+                int n = evaluate_chunk(t, c, points);
+                for (int k = 1 + (c > 0); k < n; k++)
+                {
+                    PosterSegment segment = {points[k - 1].x, points[k - 1].y, points[k].x, points[k].y, (k > 1) ? points[k - 2] : points[0], k > 1, trails[t]};
+                    if (fmaxf(segment.y0, segment.y1) + margin < band_top || fminf(segment.y0, segment.y1) - margin >= band_top + band_height) continue;
+                    if (fmaxf(segment.x0, segment.x1) + margin < 0 || fminf(segment.x0, segment.x1) - margin >= width) continue;
+                    if (segments_length == segments_capacity)
+                    {
+                        segments_capacity = segments_capacity ? 2 * segments_capacity : 4096;
+                        segments = (PosterSegment*)realloc(segments, sizeof(PosterSegment) * segments_capacity);
+                        if (segments == NULL)
+                        {
+                            printf("Failed to allocate memory to poster segments\n");
+                            exit(1);
+                        }
+                    }
+                    segments[segments_length++] = segment;
+                }
+            }
+        }
+
+        // Bin them per tile, compressed row layout: count, prefix sum, then fill in drawing order
+        memset(tile_start, 0, sizeof(int) * (tiles_x + 1));
+        for (long long k = 0; k < segments_length; k++)
+        {
+            float margin = reach(segments[k].node);
+            float left = fminf(segments[k].x0, segments[k].x1) - margin, right = fmaxf(segments[k].x0, segments[k].x1) + margin;
+            for (int tile = first_tile(left); tile <= last_tile(right); tile++) tile_start[tile + 1]++;
+        }
+        for (int tile = 0; tile < tiles_x; tile++)
+        {
+            tile_start[tile + 1] += tile_start[tile];
+        }
+        if (tile_start[tiles_x] > binned_capacity)
+        {
+            binned_capacity = tile_start[tiles_x];
+            binned = (int*)realloc(binned, sizeof(int) * binned_capacity);
+            if (binned == NULL)
+            {
+                printf("Failed to allocate memory to poster tile bins\n");
+                exit(1);
+            }
+        }
+        for (long long k = 0; k < segments_length; k++)
+        {
+            float margin = reach(segments[k].node);
+            float left = fminf(segments[k].x0, segments[k].x1) - margin, right = fmaxf(segments[k].x0, segments[k].x1) + margin;
+            for (int tile = first_tile(left); tile <= last_tile(right); tile++) binned[tile_start[tile]++] = k;
+        }
+        for (int tile = tiles_x; tile > 0; tile--)
+        {   // Filling advanced every start to the next tile's start
+            tile_start[tile] = tile_start[tile - 1];
+        }
+        tile_start[0] = 0;
+
+        // Rasterize the tiles in parallel, each into its own framebuffer that is then copied into the row
+        std::atomic<int> next_tile(0);
+        auto rasterize = [&]() -> void {
+            Framebuffer tile;
+            tile.create(POSTER_TILE_SIZE, POSTER_TILE_SIZE);
+            for (int t = next_tile++; t < tiles_x; t = next_tile++)
+            {
+                int tile_left = t * POSTER_TILE_SIZE;
+                tile.clear({BLACK});
+                for (int k = tile_start[t]; k < tile_start[t + 1]; k++)
+                {
+                    PosterSegment *segment = &segments[binned[k]];
+                    float stroke = tree.trail_width[segment->node] * scale;
+                    if (stroke > 1)
+                    {
+                        Vec2Float previous = {segment->previous.x - tile_left, segment->previous.y - band_top};
+                        tile.draw_stroke(tree.trail_colour[segment->node], segment->x0 - tile_left, segment->y0 - band_top,
+                            segment->x1 - tile_left, segment->y1 - band_top, stroke, segment->joined ? &previous : NULL);
+                    }
+                    else
+                    {
+                        tile.draw_line(tree.trail_colour[segment->node],
+                            segment->x0 - tile_left, segment->y0 - band_top, segment->x1 - tile_left, segment->y1 - band_top);
+                    }
+                }
+
+                int tile_width = (width - tile_left < POSTER_TILE_SIZE) ? width - tile_left : POSTER_TILE_SIZE;
+                for (int y = 0; y < band_height; y++)
+                {
+                    Uint8 *in = tile.pixels + (size_t)y * POSTER_TILE_SIZE * 4;
+                    Uint8 *out = rows + y * pitch + (long)tile_left * 3;
+                    for (int x = 0; x < tile_width; x++)
+                    {
+                        out[3 * x] = in[4 * x + 2];
+                        out[3 * x + 1] = in[4 * x + 1];
+                        out[3 * x + 2] = in[4 * x];
+                    }
+                }
+            }
+            tile.free_members();
+            return;
+        };
+        for (int i = 0; i < threads - 1; i++)
+        {
+            workers[i] = std::thread(rasterize);
+        }
+        rasterize();
+        for (int i = 0; i < threads - 1; i++)
+        {
+            workers[i].join();
+        }
+        drawn += segments_length;
+
+        if (fwrite(rows, pitch, band_height, file) != (size_t)band_height)
+        {
+            printf("Failed to write %s\n", out_path);
+            break;
+        }
+    }
+    bool saved = !ferror(file);
+    fclose(file);
+    if (saved) printf("Rendered %lld samples per trail to %s in %dx%d tiles, %lld segments drawn\n", samples, out_path, POSTER_TILE_SIZE, POSTER_TILE_SIZE, drawn);
+
+    delete[] workers;
+    free(rows);
+    free(tile_start);
+    free(points);
+    free(segments);
+    free(binned);
+    free(trails);
+    free(chunk_top);
+    free(chunk_bottom);
+    tree.free_members();
+    evaluator.free_members();
+    return saved ? 0 : 1;
+}
+
+bool write_bmp_header(FILE *file, int width, int height)
+{
+    // 24 bit BMP with a negative height, so rows are stored top to bottom in the order they are rendered
+    long pitch = ((long)width * 3 + 3) & ~3L;
+    long long file_size = 54 + (long long)pitch * height;
+    if (file_size > 0xFFFFFFFFLL)
+    {
+        printf("A %dx%d image is too big for a BMP file\n", width, height);
+        return false;
+    }
+
+    Uint8 header[54] = {'B', 'M'};
+    auto put32 = [&header](int offset, Uint32 value) -> void {
+        for (int i = 0; i < 4; i++) header[offset + i] = (value >> (8 * i)) & 0xFF;
+        return;
+    };
+    put32(2, file_size);
+    put32(10, 54);           // Pixel data offset
+    put32(14, 40);           // BITMAPINFOHEADER size
+    put32(18, width);
+    put32(22, -height);
+    header[26] = 1;          // Planes
+    header[28] = 24;         // Bits per pixel
+    put32(34, file_size - 54);
+    put32(38, 2835);         // 72 DPI
+    put32(42, 2835);
+
+    return fwrite(header, sizeof(header), 1, file) == 1;
+}
+
+// * Benchmark function definitions
+int run_bench()
+{
+    // Rasterizes the same random walk of trail-length segments with Wu lines and with strokes of a few widths
+    int width = 1920, height = 1080;
+    Vec2Float *points = (Vec2Float*)malloc(sizeof(Vec2Float) * (BENCH_SEGMENTS + 1));
+    if (points == NULL)
+    {
+        printf("Failed to allocate memory to benchmark segments\n");
+        exit(1);
+    }
+    srand(1);
+    points[0] = {width / 2.0f, height / 2.0f};
+    for (int i = 1; i <= BENCH_SEGMENTS; i++)
+    {   // Steps up to the segment length limit, turning gradually like a trail does
+        float angle = 2 * PI * rand() / (float)RAND_MAX, step = simulation.max_segment_length * rand() / (float)RAND_MAX;
+        points[i] = {points[i - 1].x + step * cosf(angle), points[i - 1].y + step * sinf(angle)};
+        if (points[i].x < 0 || points[i].x >= width || points[i].y < 0 || points[i].y >= height) points[i] = {width / 2.0f, height / 2.0f};
+    }
+
+    printf("SIMD kernels use %d float lanes\n", SIMD_WIDTH);
+    Framebuffer framebuffer;
+    framebuffer.create(width, height);
+    RGBA colour = {ORANGE};
+    float widths[] = {1, 1.5f, 2, 4, 8, 16};
+    double wu_rate = 0;
+    for (int w = -1; w < (int)(sizeof(widths) / sizeof(widths[0])); w++)
+    {
+        framebuffer.clear({BLACK});
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 1; i <= BENCH_SEGMENTS; i++)
+        {
+            if (w < 0) framebuffer.draw_line(colour, points[i - 1].x, points[i - 1].y, points[i].x, points[i].y);
+            else framebuffer.draw_stroke(colour, points[i - 1].x, points[i - 1].y, points[i].x, points[i].y, widths[w], (i > 1) ? &points[i - 2] : NULL);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double rate = BENCH_SEGMENTS / seconds;
+
+        if (w < 0)
+        {
+            wu_rate = rate;
+            printf("Wu line          %12.0f segments/s\n", rate);
+        }
+        else printf("Stroke %5.1f px  %12.0f segments/s  %5.2fx the time of Wu\n", widths[w], rate, wu_rate / rate);
+    }
+
+    framebuffer.free_members();
+    free(points);
+    return 0;
+}
+
+// * Edit function definitions
+void edit(Spirograph *spirograph_base_node, double dt)
+{
+    static Spirograph *selected_node = NULL, *closest_node = NULL, *new_child = NULL;
+
+    // The colour palette and speed slider are layers under the scene
+    bool editing_colour = false, editing_revps = false;
+    if (editorState.edit_mode == EditorState::EDIT_MENU)
+    {
+        colour_palette(selected_node, &editing_colour);
+        change_rotation_speed(selected_node, &editing_revps, dt);
+    }
+    damage_composite();
+    spirograph_base_node->draw(Spirograph::UNHIGHLIGHT);
+    circleSprites.flush(renderer); // Keep the scene's heads under the highlighted nodes
+
+    if (editorState.edit_mode == EditorState::EDIT_MENU) // * Edit the selected node
+    {
+        // Editing functions and editing states
+        bool editing_dirpos = false;
+        if (!editing_colour && !editing_revps)
+        {   // Editing states are used to prevent interference and only allow one thing to be edited at a time
+            edit_dirpos(selected_node, &editing_dirpos);
+            reselect_node(spirograph_base_node, closest_node, &selected_node, editing_dirpos);
+        }
+
+        // Toggle trail on key down
+        if (keyboardState.keydown(selected_node->toggle_trail_key))
+        {
+            selected_node->trail_on = !(selected_node->trail_on);
+            editorState.scene_revision++;
+        }
+
+        // Step the trail width on key down
+        if (keyboardState.keydown(selected_node->thinner_trail_key) && selected_node->trail->width > 1)
+        {
+            selected_node->trail->width = fmaxf(1, selected_node->trail->width - STROKE_WIDTH_STEP);
+            editorState.scene_revision++;
+        }
+        if (keyboardState.keydown(selected_node->thicker_trail_key) && selected_node->trail->width < STROKE_MAX_WIDTH)
+        {
+            selected_node->trail->width = fminf(STROKE_MAX_WIDTH, selected_node->trail->width + STROKE_WIDTH_STEP);
+            editorState.scene_revision++;
+        }
+
+        // Delete node on key down
+        if (keyboardState.keydown(selected_node->delete_node_key) && selected_node != spirograph_base_node)
+        {
+            Spirograph *old_parent = selected_node->parent;
+            old_parent->remove_child(selected_node);
+            editorState.scene_revision++;
+            selected_node = old_parent;
+
+            if (selected_node->is_root && spirograph_base_node->children_length == 0)
+            {   // Create new root after an old root was deleted
+                editorState.creating_first = true;
+                editorState.edit_mode = EditorState::SET_CHILD_POSITION;
+            }
+        }
+
+        // Save the scene for batch rendering
+        if (keyboardState.keydown(selected_node->save_key))
+        {
+            CompiledTree scene;
+            scene.compile(spirograph_base_node);
+            if (scene.save(editorState.scene_path)) printf("Saved scene to %s\n", editorState.scene_path);
+            scene.free_members();
+        }
+
+        // Reset spirograph
+        if (keyboardState.keydown(selected_node->reset_key) && !editorState.creating_first && spirograph_base_node->children_length > 0)
+        {
+            // Remove all the roots from the base node and set the selected node to the base node
+            spirograph_base_node->clear_children();
+            editorState.scene_revision++;
+            selected_node = spirograph_base_node;
+
+            // Create a new root after old root was deleted
+            editorState.creating_first = true;
+            editorState.edit_mode = EditorState::SET_CHILD_POSITION;
+        }
+
+        // Todo: test
+        // Switch modes when holding left CTRL
+        if (keyboardState.keystates[SDL_SCANCODE_LCTRL])
+        {
+            editorState.edit_mode = EditorState::SET_CHILD_POSITION;
+        }
+    }
+    else if (editorState.edit_mode == EditorState::SET_CHILD_POSITION) // * Set position of new node
+    {
+        // Get closest node to cursor
+        float distance;
+        Vec2Float orthproj;
+        node_near_cursor_orthproj(spirograph_base_node, &selected_node, &distance, &orthproj);
+
+        // Don't consider the base node
+        if (selected_node == spirograph_base_node && spirograph_base_node->children_length > 0)
+        {
+            selected_node = spirograph_base_node->children[0];
+        }
+        Vec2Float new_pos = {selected_node->position_initial.x + orthproj.x, selected_node->position_initial.y + orthproj.y};
+
+        // Draw segments
+        selected_node->draw_direction(Spirograph::HIGHLIGHT);
+        selected_node->draw_head(Spirograph::HIGHLIGHT);
+        circleSprites.add({YELLOW}, new_pos.x, new_pos.y, 3, true);
+        drawLine(renderer, {ORANGE}, MouseState.pos.x, MouseState.pos.y, new_pos.x, new_pos.y);
+
+        // Mouse events
+        if (MouseState.left_down)
+        {   // Add new child and switch to set direction mode
+            new_child = new Spirograph(new_pos, {(float)MouseState.pos.x, (float)MouseState.pos.y});
+            selected_node->add_child(new_child);
+            new_child->direction_initial = new_child->direction = {MouseState.pos.x - new_child->position_initial.x, MouseState.pos.y - new_child->position_initial.y};
+            editorState.scene_revision++;
+            editorState.edit_mode = EditorState::SET_CHILD_DIRECTION;
+
+            if (selected_node == spirograph_base_node)
+            {
+                editorState.creating_first = false;
+            }
+        }
+
+        // Todo: test
+        // Switch modes when left CTRL up
+        if (keyboardState.keyup(SDL_SCANCODE_LCTRL))
+        {
+            editorState.edit_mode = EditorState::EDIT_MENU;
+        }
+    }
+    else if (editorState.edit_mode == EditorState::SET_CHILD_DIRECTION) // * Set direction of new node
+    {
+        // Fix direction vector to cursor and draw, the preview only restarts when the mouse moved
+        Vec2Float direction = {MouseState.pos.x - new_child->position_initial.x, MouseState.pos.y - new_child->position_initial.y};
+        if (memcmp(&new_child->direction_initial, &direction, sizeof(Vec2Float)))
+        {
+            new_child->direction_initial = new_child->direction = direction;
+            editorState.scene_revision++;
+        }
+        selected_node->draw_direction(Spirograph::HIGHLIGHT);
+        selected_node->draw_head(Spirograph::HIGHLIGHT);
+
+        // Mouse events
+        if (MouseState.left_up)
+        {
+            MouseState.left_up = false;
+            selected_node = new_child;
+            if (!new_child->is_root)
+            {
+                new_child->trail_on = true;
+            }
+
+            // Change mode
+            if (keyboardState.keystates[SDL_SCANCODE_LCTRL])
+            {
+                editorState.edit_mode = EditorState::SET_CHILD_POSITION;
+            }
+            else
+            {
+                editorState.edit_mode = EditorState::EDIT_MENU;
+            }
+        }
+        else if (MouseState.right_down)
+        {
+            MouseState.right_down = false;
+            editorState.edit_mode = EditorState::SET_CHILD_POSITION;
+        }
+    }
+
+    return;
+}
+
+void reselect_node(Spirograph *spirograph_base_node, Spirograph *closest_node, Spirograph **selected_node, bool editing_dirpos)
+{
+    // Get closest node to cursor
+    float node_distance;
+    Vec2Float orthproj;
+    node_near_cursor_orthproj(spirograph_base_node, &closest_node, &node_distance, &orthproj);
+
+    // Don't consider the base node
+    if (closest_node == spirograph_base_node)
+    {
+        if (spirograph_base_node->children_length > 0)
+        {
+            closest_node = spirograph_base_node->children[0];
+        }
+        else
+        {
+            editorState.edit_mode = EditorState::SET_CHILD_POSITION;
+            return;
+        }
+    }
+
+    // Draw closest and selected node
+    if (!editing_dirpos)
+    {
+        closest_node->draw_direction(Spirograph::LIGHT_HIGHLIGHT);
+        closest_node->draw_head(Spirograph::UNHIGHLIGHT);
+    }
+    (*selected_node)->draw_direction(Spirograph::HIGHLIGHT);
+    (*selected_node)->draw_head(Spirograph::HIGHLIGHT);
+    (*selected_node)->draw_base(Spirograph::HIGHLIGHT);
+    
+    // Mouse events
+    if (MouseState.left_down && !editing_dirpos)
+    {   // Select closest node on click
+        MouseState.left_down = false;
+        *selected_node = closest_node;
+    }
+
+    return;
+}
+
+void edit_dirpos(Spirograph *selected_node, bool *editing)
+{
+    // Holding and hovering base and head states
+    static bool holding_head, holding_base;
+    Vec2Float direction_before = selected_node->direction_initial, position_before = selected_node->position_initial;
+    Vec2Float head_position = {selected_node->position_initial.x + selected_node->direction_initial.x, selected_node->position_initial.y + selected_node->direction_initial.y};
+    const bool hovering_base = pow(MouseState.pos.x - selected_node->position_initial.x, 2) + pow(MouseState.pos.y - selected_node->position_initial.y, 2) <= pow(selected_node->hover_radius, 2);
+    const bool hovering_head = pow(MouseState.pos.x - head_position.x, 2) + pow(MouseState.pos.y - head_position.y, 2) <= pow(selected_node->hover_radius, 2);
+
+    // Update holding and hovering base and head states on mouse and keyboard events        
+    if (keyboardState.keystates[selected_node->change_head_key] || (hovering_head && MouseState.left_down))
+    {
+        holding_head = true;
+    }
+    else if (!MouseState.left_down)
+    {
+        holding_head = false;
+    }
+    
+    if (keyboardState.keystates[selected_node->change_base_key] || (hovering_base && !selected_node->is_root && MouseState.left_down))
+    {
+        holding_base = true;
+    }
+    else if (!MouseState.left_down)
+    {
+        holding_base = false;
     }
 
     // Change direction based on head state
     if (!hovering_head && !holding_head)
     {
-        selected_node->head_radius = selected_node->default_radius;
+        selected_node->head_radius = selected_node->default_radius;
+    }
+    else if (hovering_head)
+    {   // Highlight the head when it's being hovered by increasing the radius
+        selected_node->head_radius = selected_node->hover_radius;
+        selected_node->draw_head(Spirograph::HIGHLIGHT);
+    }
+    else if (holding_head)
+    {   // Fix the direction vector on mouse position
+        selected_node->direction_initial = selected_node->direction = {MouseState.pos.x - selected_node->position_initial.x, MouseState.pos.y - selected_node->position_initial.y};
+    }
+    
+    // Change position based on base state
+    if (!hovering_base && !holding_base)
+    {
+        selected_node->base_radius = selected_node->default_radius;
+    }
+    else if (hovering_base && !selected_node->is_root)
+    {   // Highlight the base when it's being hovered by increasing the radius
+        selected_node->base_radius = selected_node->hover_radius;
+        selected_node->draw_base(Spirograph::HIGHLIGHT);
+    }
+    else if (holding_base)
+    {   // Fix the position vector on the orthogonal porjection of the mouse position on the parent direction
+        // Get parent orthogonal projection taking direction vector boundaries into account
+        Vec2Float parent_orthproj = selected_node->parent->get_cursor_orthogonalProjection();
+        float proj_scale = parent_orthproj.x ? parent_orthproj.x / selected_node->parent->direction_initial.x : parent_orthproj.y / selected_node->parent->direction_initial.y;
+        if (proj_scale <= 0) 
+        {
+            proj_scale = 0;
+            parent_orthproj = {0, 0};
+        }
+        else if (proj_scale >= 1)
+        {
+            proj_scale = 1;
+            parent_orthproj = selected_node->parent->direction_initial;
+        }
+        
+        // Set new position and recalculate positionon parent
+        selected_node->position_initial = selected_node->position = {selected_node->parent->position_initial.x + parent_orthproj.x, selected_node->parent->position_initial.y + parent_orthproj.y};
+        selected_node->position_on_parent = proj_scale;
+    }
+
+    // Update children's position based on the new direction
+    if (holding_head || holding_base)
+    {
+        selected_node->update_childrens_position_on_parent();
+        if (memcmp(&direction_before, &selected_node->direction_initial, sizeof(Vec2Float)) || memcmp(&position_before, &selected_node->position_initial, sizeof(Vec2Float)))
+        {
+            editorState.scene_revision++;
+        }
+    }
+
+    *editing = (hovering_base || holding_base || hovering_head || holding_head);
+
+    return;
+}
+
+void node_near_cursor_orthproj(Spirograph *spirograph_base_node, Spirograph **closest, float *distance2, Vec2Float *orthproj)
+{
+    *closest = spirograph_base_node;
+
+    // Calculate orthogonal projection distance from cursor
+    *orthproj = spirograph_base_node->get_cursor_orthogonalProjection();
+    float proj_scale = orthproj->x ? orthproj->x / spirograph_base_node->direction_initial.x : orthproj->y / spirograph_base_node->direction_initial.y;
+
+    // Bounds for the orthogonal projection
+    if (proj_scale <= 0)
+    {
+        *orthproj = {0, 0};
+    }
+    else if (proj_scale >= 1)
+    {
+        *orthproj = spirograph_base_node->direction_initial;
+    }
+
+    int mouseX = MouseState.pos.x, mouseY = MouseState.pos.y;
+    float closest_distance2 = pow(spirograph_base_node->position_initial.x + orthproj->x - mouseX, 2) + pow(spirograph_base_node->position_initial.y + orthproj->y - mouseY, 2);
+
+    // Find closest distance between parent and children
+    for (int i = 0; i < spirograph_base_node->children_length; i++)
+    {
+        // Get closest grandchild
+        Spirograph *closest_grandchild;
+        float child_distance2;
+        Vec2Float child_orthproj;
+        node_near_cursor_orthproj(spirograph_base_node->children[i], &closest_grandchild, &child_distance2, &child_orthproj);
+
+        // Check if its the minimum distance
+        if (child_distance2 < closest_distance2)
+        {
+            closest_distance2 = child_distance2;
+            *closest = closest_grandchild;
+            *orthproj = child_orthproj;
+        }
+    }
+
+    *distance2 = closest_distance2;
+
+    return;
+}
+
+void colour_palette(Spirograph *current_node, bool *hovering)
+{
+    RGBA selected_colour = current_node->trail->colour;
+    
+    // Dimensions
+    int partitions = 3;
+    int margin = 20;
+    int spacing = margin * 0.25;
+    int button_radius = ((display.height - 2*margin) / (float)(partitions*partitions) - spacing*((partitions*partitions - 1) / (float)(partitions*partitions))) / 2.0f;
+    int draw_distance = 2*button_radius + spacing;
+    int width = 2*margin + (partitions-1)*spacing + partitions*2*button_radius;
+
+    // Buttons are laid out in a column per red value, each with every green and blue combination
+    auto button_colour = [partitions](int button) -> RGBA {
+        int ri = button / (partitions*partitions), gi = button % (partitions*partitions) / partitions, bi = button % partitions;
+        return {ri * (255 / (float)(partitions - 1)), gi * (255 / (float)(partitions - 1)), bi * (255 / (float)(partitions - 1)), 255};
+    };
+
+    // Tell edit function if the user is hovering the colour palette interface
+    *hovering = MouseState.pos.x <= width;
+
+    // Find the hovered button from the grid cell under the cursor instead of testing every button
+    int hovered_button = -1;
+    int grid_x = MouseState.pos.x - margin, grid_y = MouseState.pos.y - margin;
+    if (grid_x >= 0 && grid_y >= 0 && grid_x / draw_distance < partitions && grid_y / draw_distance < partitions*partitions)
+    {
+        int column = grid_x / draw_distance, row = grid_y / draw_distance;
+        int dx = grid_x - column*draw_distance - button_radius;
+        int dy = grid_y - row*draw_distance - button_radius;
+        if (dx*dx + dy*dy <= button_radius*button_radius) hovered_button = column*partitions*partitions + row;
+    }
+
+    // Detect click
+    if (MouseState.left_down && hovered_button >= 0) selected_colour = button_colour(hovered_button);
+    if (memcmp(&current_node->trail->colour, &selected_colour, sizeof(RGBA)))
+    {
+        current_node->trail->colour = selected_colour;
+        editorState.scene_revision++;
+    }
+
+    // The palette is kept in a texture and only redrawn when the hovered or selected button changes
+    static SDL_Texture *texture = NULL;
+    static int drawn_hovered;
+    static RGBA drawn_selected;
+    if (texture == NULL)
+    {
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, width, display.height);
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    }
+    else if (drawn_hovered == hovered_button && !memcmp(&drawn_selected, &selected_colour, sizeof(RGBA)))
+    {
+        damage_layer(texture, {0, 0, width, display.height}, false);
+        return;
+    }
+    drawn_hovered = hovered_button;
+    drawn_selected = selected_colour;
+
+    // Draw
+    SDL_SetRenderTarget(renderer, texture);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
+    for (int button = 0; button < partitions*partitions*partitions; button++)
+    {
+        // Button properties
+        RGBA colour = button_colour(button);
+        int x = margin + button_radius + (button / (partitions*partitions) * draw_distance);
+        int y = margin + button_radius + (button % (partitions*partitions) * draw_distance);
+
+        // Highlight button when already selected
+        if (colour.r == selected_colour.r && colour.g == selected_colour.g && colour.b == selected_colour.b && colour.a == selected_colour.a)
+        {
+            SDL_SetRenderDrawColor(renderer, WHITE);
+            SDL_RenderFillCircle(renderer, x, y, button_radius + 0.45*spacing); 
+            SDL_SetRenderDrawColor(renderer, BLACK);
+            SDL_RenderFillCircle(renderer, x, y, button_radius + 0.15*spacing); 
+        }
+        else if (button == hovered_button)
+        {
+            SDL_SetRenderDrawColor(renderer, WHITE);
+            SDL_RenderFillCircle(renderer, x, y, button_radius + 0.25*spacing); 
+            SDL_SetRenderDrawColor(renderer, BLACK);
+            SDL_RenderFillCircle(renderer, x, y, button_radius + 0.15*spacing); 
+        }
+        
+        // Draw button 
+        SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(colour));
+        SDL_RenderFillCircle(renderer, x, y, button_radius); 
+    }
+    SDL_SetRenderTarget(renderer, NULL);
+    damage_layer(texture, {0, 0, width, display.height}, true);
+
+    return;
+}
+
+void change_rotation_speed(Spirograph *selected_node, bool *editing, double dt)
+{
+    // Define static slider struct
+    static struct
+    {
+        int margin = 30;
+        int x = display.width - margin;
+        int y;
+        int top = margin;
+        int bottom = display.height - margin;
+        int r = 5;
+        int hover_r = 7;
+        float min_value = 0;
+        float max_value = 2;
+        float value;
+    }
+    slider;
+
+    // Update value and y position based on the revolutions per second set on the selected node
+    slider.value = selected_node->revps;
+    slider.y = ((slider.top - slider.bottom) / (float)(slider.max_value - slider.min_value)) * slider.value + slider.bottom;
+
+    // Detect slider and area hover
+    bool hovering_slider = pow(MouseState.pos.x - slider.x, 2) + pow(MouseState.pos.y - slider.y, 2) <= pow(slider.hover_r, 2);
+    bool hovering_area = MouseState.pos.x > display.width - 2*slider.margin;
+    static bool holding = false;
+
+    // Detect mouse clicks
+    if (MouseState.left_down && hovering_area) holding = true;
+    else if (!MouseState.left_down) holding = false;
+    if (MouseState.left_up) selected_node->reset();
+
+    // Update the edit function if actions are being performed on the slider
+    *editing = hovering_slider || holding || hovering_area;
+
+    // Draw slider, kept in a texture that is only redrawn when the slider moves or its hover state changes
+    static SDL_Texture *texture = NULL;
+    static int drawn_y;
+    static bool drawn_hovering;
+    SDL_Rect rect = {display.width - 2*slider.margin, 0, 2*slider.margin, display.height};
+    bool redraw = texture == NULL || drawn_y != slider.y || drawn_hovering != hovering_slider;
+    if (redraw)
+    {
+        if (texture == NULL)
+        {
+            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, rect.w, rect.h);
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+        }
+        drawn_y = slider.y;
+        drawn_hovering = hovering_slider;
+
+        SDL_SetRenderTarget(renderer, texture);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        SDL_RenderClear(renderer);
+        SDL_SetRenderDrawColor(renderer, WHITE);
+        SDL_RenderFillCircle(renderer, slider.x - rect.x, slider.y, hovering_slider ? slider.hover_r : slider.r);
+        drawLine(renderer, {WHITE}, slider.x - rect.x, slider.top, slider.x - rect.x, slider.bottom);
+        SDL_SetRenderTarget(renderer, NULL);
+    }
+    damage_layer(texture, rect, redraw);
+
+    // Control with the mouse if holding and update the rotation speed of the selected node based on the y position of the slider
+    if (holding)
+    {
+        slider.y = MouseState.pos.y;
+        if (slider.y > slider.bottom) slider.y = slider.bottom;
+        if (slider.y < slider.top) slider.y = slider.top;
+
+        selected_node->rotate(dt);
+        
+        float revps = selected_node->revps;
+        selected_node->revps = ((slider.max_value - slider.min_value) / (float)(slider.top - slider.bottom)) * (slider.y - slider.bottom);
+        selected_node->revps = ceil(selected_node->revps * 100) / 100.0f;
+        if (selected_node->revps != revps) editorState.scene_revision++;
+    }
+
+    return;
+}
+
+// * SpirographNode method definitions
+Spirograph::Spirograph(Vec2Float position_i, Vec2Float direction_i)
+{
+    // Initial position and direction vectors
+    position_initial = position = position_i;
+    direction_initial = direction = direction_i;
+
+    head_radius = base_radius = default_radius;
+    revps = 0.3;
+    
+    children_length = 0;
+    children = (Spirograph**)malloc(0);
+    parent = NULL;
+    
+    is_root = false;
+
+    // Trail
+    trail_on = false;
+    trail = new Trail({WHITE});
+    update_trail_first_point();
+}
+
+void Spirograph::rotate(double dt)
+{
+    // Cosine and sine of the angle adjusted by dt
+    float cos_a = cos((revps * 2 * PI) * dt);
+    float sin_a = sin((revps * 2 * PI) * dt);
+
+    // Rotate direction vector
+    direction = {(direction.x * cos_a) - (direction.y * sin_a), (direction.x * sin_a) + (direction.y * cos_a)};
+
+    // Adjust children's positions based on rotation
+    for (int i = 0; i < children_length; i++)
+    {
+        children[i]->position.x = position.x + (direction.x * children[i]->position_on_parent);
+        children[i]->position.y = position.y + (direction.y * children[i]->position_on_parent);
+    }
+
+    // Rotate children
+    for (int i = 0; i < children_length; i++)
+    {
+        children[i]->rotate(dt);
+    }
+
+    return;
+}
+
+void Spirograph::update_trail_first_point()
+{
+    trail->first_point = {
+        position_initial.x + direction_initial.x,
+        position_initial.y + direction_initial.y
+    };
+    return;
+}
+
+void Spirograph::draw(HighlightType highlight_type)
+{
+    for (int i = 0; i < children_length; i++) 
+    {
+        children[i]->draw(highlight_type);
+    }
+    
+    draw_direction(highlight_type);
+    draw_head(highlight_type);
+
+    return;
+}
+
+void Spirograph::draw_direction(HighlightType highlight_type)
+{
+    if (is_root) return;
+    Vec2Float base = view_to_screen(position), head = view_to_screen({position.x + direction.x, position.y + direction.y});
+    drawLine(renderer, highlightColour[highlight_type], base.x, base.y, head.x, head.y);
+    return;
+}
+
+void Spirograph::draw_head(HighlightType highlight_type)
+{
+    RGBA colour = trail->colour;
+    colour.a = highlightAlpha[highlight_type];
+    
+    if (is_root) return;
+
+    // Queued on the circle sprites, drawn over the lines when they are flushed
+    Vec2Float head = view_to_screen({position.x + direction.x, position.y + direction.y});
+    if (trail_on)
+    {
+        circleSprites.add(colour, head.x, head.y, head_radius, true);
+    }
+    else
+    {
+        circleSprites.add(display.background_colour, head.x, head.y, head_radius, true);
+        circleSprites.add(colour, head.x, head.y, head_radius, false);
+    }
+    return;
+}
+
+void Spirograph::draw_base(HighlightType highlight_type)
+{
+    if (is_root) return;
+
+    Vec2Float base = view_to_screen(position);
+    circleSprites.add(display.background_colour, base.x, base.y, base_radius, true);
+    circleSprites.add(highlightColour[highlight_type], base.x, base.y, base_radius, false);
+
+    return;
+}
+
+void Spirograph::reset()
+{
+    // Set position back to initial position
+    position = position_initial;
+    direction = direction_initial;
+
+    // Reset trail
+    trail->reset();
+
+    // reset children
+    for (int i = 0; i < children_length; i++)
+    {
+        children[i]->reset();
+    }
+
+    return;
+}
+
+void Spirograph::update_childrens_position_on_parent()
+{
+    // Update children's position on parent of this node
+    for (int i = 0; i < children_length; i++)
+    {
+        children[i]->position_initial = children[i]->position = {
+            position.x + (direction.x * children[i]->position_on_parent),
+            position.y + (direction.y * children[i]->position_on_parent)
+        };
+        
+        // Update children's position on parent of each of this node's children's children
+        children[i]->update_childrens_position_on_parent();
+    }
+
+    return;
+}
+
+void Spirograph::add_child(Spirograph *new_child_ptr)
+{
+    // Append to dynamically allocated array of child pointers
+    children_length++;
+
+    children = (Spirograph**)realloc(children, sizeof(Spirograph*) * children_length);
+    if (children == NULL)
+    {
+        printf("Failed to allocate memory to children array in Spiroraph\n");
+        exit(1);
+    }
+    children[children_length - 1] = new_child_ptr;
+
+    // Initialize child's parent pointer, position on parent, and rotation
+    new_child_ptr->parent = this;
+    Vec2Float child_end = {new_child_ptr->position_initial.x - position_initial.x, new_child_ptr->position_initial.y - position_initial.y};
+    new_child_ptr->position_on_parent = (direction_initial.x) ? child_end.x / direction_initial.x : child_end.y / direction_initial.y;
+    new_child_ptr->revps += revps;
+
+    return;
+}
+
+void Spirograph::remove_child(Spirograph *old_child_ptr)
+{
+    for (int i = 0; i < children_length; i++)
+    {
+        if (children[i] == old_child_ptr)
+        {
+            // Children are created with new, and free their trail and their own children first
+            old_child_ptr->free_members();
+            delete old_child_ptr;
+
+            for (int j = i; j < children_length - 1; j++)
+            {
+                children[j] = children[j + 1];
+            }
+            children_length--;
+
+            return;
+        }
+    }
+
+    return;
+}
+
+void Spirograph::free_members()
+{
+    trail->free_members();
+    delete trail;
+
+    // Children
+    clear_children();
+    free(children);
+    children = NULL;
+
+    return;
+}
+
+void Spirograph::clear_children()
+{
+    for (int i = 0; i < children_length; i++)
+    {
+        children[i]->free_members();
+        delete children[i];
+    }
+    children_length = 0;
+
+    return;
+}
+
+Vec2Float Spirograph::get_cursor_orthogonalProjection()
+{
+    float proj_coeff =
+        (((MouseState.pos.x - position_initial.x)*direction_initial.x) +
+        ((MouseState.pos.y - position_initial.y)*direction_initial.y)) /
+        (pow(direction_initial.x, 2) + pow(direction_initial.y, 2));
+    Vec2Float orthogonal_projection = {proj_coeff * direction_initial.x, proj_coeff * direction_initial.y};
+    return orthogonal_projection;
+}
+
+// * CompiledTree method definitions
+CompiledTree::CompiledTree()
+{
+    nodes_length = nodes_capacity = 0;
+    canvas_width = canvas_height = 0;
+    nodes = NULL;
+    trails = NULL;
+    trail_on = NULL;
+    trail_colour = NULL;
+    trail_width = NULL;
+    parent = NULL;
+    position_x = position_y = NULL;
+    direction_x = direction_y = NULL;
+    direction_initial_x = direction_initial_y = NULL;
+    position_on_parent = NULL;
+    revps = NULL;
+    time = 0;
+}
+
+void CompiledTree::reserve(int count)
+{
+    if (count <= nodes_capacity) return;
+
+    nodes_capacity = count;
+    nodes = (Spirograph**)realloc(nodes, sizeof(Spirograph*) * count);
+    trails = (Trail**)realloc(trails, sizeof(Trail*) * count);
+    trail_on = (bool*)realloc(trail_on, sizeof(bool) * count);
+    trail_colour = (RGBA*)realloc(trail_colour, sizeof(RGBA) * count);
+    trail_width = (float*)realloc(trail_width, sizeof(float) * count);
+    parent = (int*)realloc(parent, sizeof(int) * count);
+    position_x = (float*)realloc(position_x, sizeof(float) * count);
+    position_y = (float*)realloc(position_y, sizeof(float) * count);
+    direction_x = (float*)realloc(direction_x, sizeof(float) * count);
+    direction_y = (float*)realloc(direction_y, sizeof(float) * count);
+    direction_initial_x = (float*)realloc(direction_initial_x, sizeof(float) * count);
+    direction_initial_y = (float*)realloc(direction_initial_y, sizeof(float) * count);
+    position_on_parent = (float*)realloc(position_on_parent, sizeof(float) * count);
+    revps = (float*)realloc(revps, sizeof(float) * count);
+    if (!nodes || !trails || !trail_on || !trail_colour || !trail_width || !parent || !position_x || !position_y || !direction_x || !direction_y || !direction_initial_x || !direction_initial_y || !position_on_parent || !revps)
+    {
+        printf("Failed to allocate memory to compile the spirograph tree\n");
+        exit(1);
+    }
+
+    return;
+}
+
+void CompiledTree::compile(Spirograph *root)
+{
+    // Count the nodes so every array is allocated once
+    int count = 0;
+    Spirograph **stack = (Spirograph**)malloc(sizeof(Spirograph*));
+    int stack_length = 1, stack_capacity = 1;
+    stack[0] = root;
+    while (stack_length > 0)
+    {
+        Spirograph *node = stack[--stack_length];
+        count++;
+        if (stack_length + node->children_length > stack_capacity)
+        {
+            stack_capacity = stack_length + node->children_length;
+            stack = (Spirograph**)realloc(stack, sizeof(Spirograph*) * stack_capacity);
+            if (stack == NULL)
+            {
+                printf("Failed to allocate memory to compile the spirograph tree\n");
+                exit(1);
+            }
+        }
+        for (int i = 0; i < node->children_length; i++)
+        {
+            stack[stack_length++] = node->children[i];
+        }
+    }
+    free(stack);
+    reserve(count);
+
+    // Breadth-first layout, the nodes array doubles as the queue
+    nodes[0] = root;
+    parent[0] = -1;
+    nodes_length = 1;
+    for (int head = 0; head < nodes_length; head++)
+    {
+        Spirograph *node = nodes[head];
+        for (int i = 0; i < node->children_length; i++)
+        {
+            nodes[nodes_length] = node->children[i];
+            parent[nodes_length] = head;
+            nodes_length++;
+        }
+
+        trails[head] = node->trail_on ? node->trail : NULL;
+        trail_on[head] = node->trail_on;
+        trail_colour[head] = node->trail->colour;
+        trail_width[head] = node->trail->width;
+        position_x[head] = node->position_initial.x;
+        position_y[head] = node->position_initial.y;
+        direction_x[head] = direction_initial_x[head] = node->direction_initial.x;
+        direction_y[head] = direction_initial_y[head] = node->direction_initial.y;
+        position_on_parent[head] = (head == 0) ? 0 : node->position_on_parent;
+        revps[head] = node->revps;
+    }
+    canvas_width = display.width;
+    canvas_height = display.height;
+    time = 0;
+
+    return;
+}
+
+void CompiledTree::copy(CompiledTree *other)
+{
+    // Reuses this tree's arrays, only growing them when the other tree is larger
+    reserve(other->nodes_length);
+    nodes_length = other->nodes_length;
+    canvas_width = other->canvas_width;
+    canvas_height = other->canvas_height;
+    memcpy(nodes, other->nodes, sizeof(Spirograph*) * nodes_length);
+    memcpy(trails, other->trails, sizeof(Trail*) * nodes_length);
+    memcpy(trail_on, other->trail_on, sizeof(bool) * nodes_length);
+    memcpy(trail_colour, other->trail_colour, sizeof(RGBA) * nodes_length);
+    memcpy(trail_width, other->trail_width, sizeof(float) * nodes_length);
+    memcpy(parent, other->parent, sizeof(int) * nodes_length);
+    memcpy(position_x, other->position_x, sizeof(float) * nodes_length);
+    memcpy(position_y, other->position_y, sizeof(float) * nodes_length);
+    memcpy(direction_x, other->direction_x, sizeof(float) * nodes_length);
+    memcpy(direction_y, other->direction_y, sizeof(float) * nodes_length);
+    memcpy(direction_initial_x, other->direction_initial_x, sizeof(float) * nodes_length);
+    memcpy(direction_initial_y, other->direction_initial_y, sizeof(float) * nodes_length);
+    memcpy(position_on_parent, other->position_on_parent, sizeof(float) * nodes_length);
+    memcpy(revps, other->revps, sizeof(float) * nodes_length);
+    time = other->time;
+
+    return;
+}
+
+bool CompiledTree::save(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        printf("Failed to open %s for writing\n", path);
+        return false;
+    }
+
+    // Header, canvas size and one line per node in breadth-first order
+    fprintf(file, "spirograph-scene 1\n%d %d\n%d\n", canvas_width, canvas_height, nodes_length);
+    for (int i = 0; i < nodes_length; i++)
+    {
+        fprintf(file, "%d %.9g %.9g %.9g %.9g %.9g %.9g %d %g %g %g %g\n",
+            parent[i], position_on_parent[i], position_x[i], position_y[i], direction_initial_x[i], direction_initial_y[i],
+            revps[i], trail_on[i], trail_colour[i].r, trail_colour[i].g, trail_colour[i].b, trail_width[i]);
+    }
+    fclose(file);
+
+    return true;
+}
+
+bool CompiledTree::load(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("Failed to open %s\n", path);
+        return false;
+    }
+
+    int version, count;
+    if (fscanf(file, "spirograph-scene %d %d %d %d", &version, &canvas_width, &canvas_height, &count) != 4 || version != 1 || count < 1)
+    {
+        printf("%s is not a spirograph scene\n", path);
+        fclose(file);
+        return false;
+    }
+
+    // Node lines are read whole, so the trail width can be left out by scenes saved before it existed
+    char text[512];
+    int line = 3;
+    if (fgets(text, sizeof(text), file) == NULL) text[0] = '\0'; // Rest of the header's last line
+
+    reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        int on, fields = EOF;
+        trail_width[i] = 1;
+        while (fields == EOF && fgets(text, sizeof(text), file) != NULL)
+        {   // Blank lines are skipped
+            line++;
+            fields = sscanf(text, "%d %f %f %f %f %f %f %d %f %f %f %f",
+                &parent[i], &position_on_parent[i], &position_x[i], &position_y[i], &direction_initial_x[i], &direction_initial_y[i],
+                &revps[i], &on, &trail_colour[i].r, &trail_colour[i].g, &trail_colour[i].b, &trail_width[i]);
+        }
+        if (fields < 11 || parent[i] >= i || (i > 0 && parent[i] < 0) || trail_width[i] < 1)
+        {   // Parents must come before their children
+            printf("%s has an invalid node on line %d\n", path, line + (fields == EOF));
+            fclose(file);
+            return false;
+        }
+        nodes[i] = NULL;
+        trails[i] = NULL;
+        trail_on[i] = on;
+        trail_colour[i].a = 255;
+    }
+    fclose(file);
+
+    nodes_length = count;
+    seek(0);
+
+    return true;
+}
+
+void CompiledTree::seek(double t)
+{
+    for (int i = 0; i < nodes_length; i++)
+    {
+        // The parent was already placed earlier in this pass
+        int p = parent[i];
+        if (p >= 0)
+        {
+            position_x[i] = position_x[p] + (direction_x[p] * position_on_parent[i]);
+            position_y[i] = position_y[p] + (direction_y[p] * position_on_parent[i]);
+        }
+
+        // Rotate the initial direction by the whole angle, keeping only the fraction of a turn to stay precise for large t
+        double turns = revps[i] * t;
+        double angle = (turns - floor(turns)) * 2 * PI;
+        float cos_a = cos(angle);
+        float sin_a = sin(angle);
+        direction_x[i] = (direction_initial_x[i] * cos_a) - (direction_initial_y[i] * sin_a);
+        direction_y[i] = (direction_initial_x[i] * sin_a) + (direction_initial_y[i] * cos_a);
+    }
+    time = t;
+
+    return;
+}
+
+void CompiledTree::apply()
+{
+    // Copy the animated state back to the editor nodes so they can be drawn
+    for (int i = 0; i < nodes_length; i++)
+    {
+        if (nodes[i] == NULL) continue; // Loaded from a scene file
+        nodes[i]->position = {position_x[i], position_y[i]};
+        nodes[i]->direction = {direction_x[i], direction_y[i]};
+    }
+
+    return;
+}
+
+void CompiledTree::free_members()
+{
+    free(nodes);
+    free(trails);
+    free(trail_on);
+    free(trail_colour);
+    free(trail_width);
+    free(parent);
+    free(position_x);
+    free(position_y);
+    free(direction_x);
+    free(direction_y);
+    free(direction_initial_x);
+    free(direction_initial_y);
+    free(position_on_parent);
+    free(revps);
+    nodes_length = nodes_capacity = 0;
+    nodes = NULL;
+    trails = NULL;
+    trail_on = NULL;
+    trail_colour = NULL;
+    trail_width = NULL;
+    parent = NULL;
+    position_x = position_y = NULL;
+    direction_x = direction_y = NULL;
+    direction_initial_x = direction_initial_y = NULL;
+    position_on_parent = NULL;
+    revps = NULL;
+    time = 0;
+
+    return;
+}
+
+// * PhasorEvaluator method definitions
+PhasorEvaluator::PhasorEvaluator()
+{
+    nodes_length = 0;
+    origin = NULL;
+    phasors_start = phasors_length = NULL;
+    phasors = NULL;
+    phasors_total = phasors_capacity = 0;
+}
+
+void PhasorEvaluator::compile(CompiledTree *tree)
+{
+    nodes_length = tree->nodes_length;
+    origin = (Vec2Float*)realloc(origin, sizeof(Vec2Float) * nodes_length);
+    phasors_start = (int*)realloc(phasors_start, sizeof(int) * nodes_length);
+    phasors_length = (int*)realloc(phasors_length, sizeof(int) * nodes_length);
+    if (!origin || !phasors_start || !phasors_length)
+    {
+        printf("Failed to allocate memory to compile the phasor evaluator\n");
+        exit(1);
+    }
+
+    phasors_total = 0;
+    for (int i = 0; i < nodes_length; i++)
+    {
+        phasors_start[i] = phasors_total;
+        phasors_length[i] = 0;
+        origin[i] = {tree->position_x[0], tree->position_y[0]};
+
+        // tip = direction(i) + position_on_parent(i) * direction(parent) + ... up to the fixed base position
+        float scale = 1;
+        for (int k = i; k >= 0; scale = tree->position_on_parent[k], k = tree->parent[k])
+        {
+            float amplitude_x = scale * tree->direction_initial_x[k];
+            float amplitude_y = scale * tree->direction_initial_y[k];
+            if (tree->revps[k] == 0)
+            {   // Non-rotating vectors are constant
+                origin[i].x += amplitude_x;
+                origin[i].y += amplitude_y;
+                continue;
+            }
+
+            // Vectors rotating at the same speed add up to a single phasor
+            int j = phasors_start[i];
+            while (j < phasors_total && phasors[j].revps != tree->revps[k]) j++;
+            if (j < phasors_total)
+            {
+                phasors[j].amplitude_x += amplitude_x;
+                phasors[j].amplitude_y += amplitude_y;
+                continue;
+            }
+
+            if (phasors_total == phasors_capacity)
+            {
+                phasors_capacity = phasors_capacity ? 2 * phasors_capacity : 64;
+                phasors = (Phasor*)realloc(phasors, sizeof(Phasor) * phasors_capacity);
+                if (phasors == NULL)
+                {
+                    printf("Failed to allocate memory to compile the phasor evaluator\n");
+                    exit(1);
+                }
+            }
+            phasors[phasors_total++] = {amplitude_x, amplitude_y, tree->revps[k]};
+            phasors_length[i]++;
+        }
+    }
+
+    return;
+}
+
+Vec2Float PhasorEvaluator::tip(int node, double t)
+{
+    double x = origin[node].x, y = origin[node].y;
+    for (int j = phasors_start[node]; j < phasors_start[node] + phasors_length[node]; j++)
+    {
+        double turns = phasors[j].revps * t;
+        double angle = (turns - floor(turns)) * 2 * PI;
+        double cos_a = cos(angle), sin_a = sin(angle);
+        x += (phasors[j].amplitude_x * cos_a) - (phasors[j].amplitude_y * sin_a);
+        y += (phasors[j].amplitude_x * sin_a) + (phasors[j].amplitude_y * cos_a);
+    }
+
+    return {(float)x, (float)y};
+}
+
+double PhasorEvaluator::closure_period(CompiledTree *tree)
+{
+    // Speeds are set in hundredths of a revolution per second, so every trail is back at its start
+    // after 100 / gcd(speeds in hundredths) seconds. Returns INFINITY if some speed is not a whole hundredth
+    long divisor = 0;
+    for (int i = 0; i < nodes_length; i++)
+    {
+        if (!tree->trail_on[i]) continue;
+        for (int j = phasors_start[i]; j < phasors_start[i] + phasors_length[i]; j++)
+        {
+            double hundredths = phasors[j].revps * 100;
+            long whole = labs(lround(hundredths));
+            if (fabs(fabs(hundredths) - whole) > 0.01) return INFINITY;
+
+            // Euclid's algorithm
+            long a = divisor, b = whole;
+            while (b != 0)
+            {
+                long r = a % b;
+                a = b;
+                b = r;
+            }
+            divisor = a;
+        }
+    }
+
+    return divisor ? 100.0 / divisor : 0;
+}
+
+float PhasorEvaluator::max_speed(int node)
+{
+    // Upper bound on how fast the tip moves, in pixels per second
+    float speed = 0;
+    for (int j = phasors_start[node]; j < phasors_start[node] + phasors_length[node]; j++)
+    {
+        float amplitude = sqrt(phasors[j].amplitude_x * phasors[j].amplitude_x + phasors[j].amplitude_y * phasors[j].amplitude_y);
+        speed += amplitude * 2 * PI * fabs(phasors[j].revps);
+    }
+
+    return speed;
+}
+
+void PhasorEvaluator::tips(int node, double t0, double dt, long long first, int count, Vec2Float *out)
+{
+    // Tips at t0 + (first + k) * dt for k in [0, count). Lanes hold consecutive samples and each phasor
+    // steps forward by complex multiplication, re-seeded exactly with cos/sin at the start of every block
+    alignas(64) float block_x[PHASOR_BLOCK], block_y[PHASOR_BLOCK];
+    alignas(64) float lane_x[SIMD_WIDTH], lane_y[SIMD_WIDTH];
+
+    for (int b = 0; b < count; b += PHASOR_BLOCK)
+    {
+        int n = (count - b < PHASOR_BLOCK) ? count - b : PHASOR_BLOCK;
+
+        const simd_float origin_x = simd_set1(origin[node].x), origin_y = simd_set1(origin[node].y);
+        for (int k = 0; k < n; k += SIMD_WIDTH)
+        {
+            simd_store(block_x + k, origin_x);
+            simd_store(block_y + k, origin_y);
+        }
+
+        for (int j = phasors_start[node]; j < phasors_start[node] + phasors_length[node]; j++)
+        {
+            const Phasor phasor = phasors[j];
+
+            // Seed each lane with the phasor at its first sample
+            for (int l = 0; l < SIMD_WIDTH; l++)
+            {
+                double turns = phasor.revps * (t0 + (first + b + l) * dt);
+                double angle = (turns - floor(turns)) * 2 * PI;
+                double cos_a = cos(angle), sin_a = sin(angle);
+                lane_x[l] = (phasor.amplitude_x * cos_a) - (phasor.amplitude_y * sin_a);
+                lane_y[l] = (phasor.amplitude_x * sin_a) + (phasor.amplitude_y * cos_a);
+            }
+            simd_float z_x = simd_load(lane_x), z_y = simd_load(lane_y);
+
+            // Rotation that advances every lane by SIMD_WIDTH samples
+            double step_turns = phasor.revps * dt * SIMD_WIDTH;
+            double step_angle = (step_turns - floor(step_turns)) * 2 * PI;
+            const simd_float cos_s = simd_set1((float)cos(step_angle)), sin_s = simd_set1((float)sin(step_angle));
+
+            for (int k = 0; k < n; k += SIMD_WIDTH)
+            {
+                simd_store(block_x + k, simd_add(simd_load(block_x + k), z_x));
+                simd_store(block_y + k, simd_add(simd_load(block_y + k), z_y));
+
+                simd_float next_x = simd_sub(simd_mul(z_x, cos_s), simd_mul(z_y, sin_s));
+                z_y = simd_add(simd_mul(z_x, sin_s), simd_mul(z_y, cos_s));
+                z_x = next_x;
+            }
+        }
+
+        for (int k = 0; k < n; k++)
+        {
+            out[b + k] = {block_x[k], block_y[k]};
+        }
+    }
+
+    return;
+}
+
+void PhasorEvaluator::tips_reference(int node, double t0, double dt, long long first, int count, Vec2Float *out)
+{
+    // Scalar double precision path used to check the accuracy of tips
+    for (int k = 0; k < count; k++)
+    {
+        out[k] = tip(node, t0 + (first + k) * dt);
+    }
+
+    return;
+}
+
+void PhasorEvaluator::free_members()
+{
+    free(origin);
+    free(phasors_start);
+    free(phasors_length);
+    free(phasors);
+    nodes_length = 0;
+    origin = NULL;
+    phasors_start = phasors_length = NULL;
+    phasors = NULL;
+    phasors_total = phasors_capacity = 0;
+
+    return;
+}
+
+// * Framebuffer method definitions
+Framebuffer::Framebuffer()
+{
+    width = height = 0;
+    pixels = NULL;
+    dirty_top = 0;
+    dirty_bottom = -1;
+    lit = NULL;
+    tiles_x = tiles_y = 0;
+}
+
+void Framebuffer::create(int w, int h)
+{
+    width = w;
+    height = h;
+    pixels = (Uint8*)realloc(pixels, (size_t)width * height * 4);
+    tiles_x = (width + DECAY_TILE - 1) / DECAY_TILE;
+    tiles_y = (height + DECAY_TILE - 1) / DECAY_TILE;
+    lit = (Uint8*)realloc(lit, (size_t)tiles_x * tiles_y);
+    if (pixels == NULL || lit == NULL)
+    {
+        printf("Failed to allocate memory to a %dx%d framebuffer\n", width, height);
+        exit(1);
+    }
+
+    return;
+}
+
+void Framebuffer::clear(RGBA colour)
+{
+    Uint8 pixel[4] = {(Uint8)colour.r, (Uint8)colour.g, (Uint8)colour.b, (Uint8)colour.a};
+    Uint32 value;
+    memcpy(&value, pixel, 4);
+    SDL_memset4(pixels, value, (size_t)width * height);
+    memset(lit, colour.r || colour.g || colour.b, (size_t)tiles_x * tiles_y);
+    mark_dirty(0, height - 1);
+
+    return;
+}
+
+void Framebuffer::mark_dirty(int top, int bottom)
+{
+    if (top < 0) top = 0;
+    if (bottom >= height) bottom = height - 1;
+    if (top > bottom) return;
+
+    if (dirty_top > dirty_bottom)
+    {
+        dirty_top = top;
+        dirty_bottom = bottom;
+    }
+    else
+    {
+        if (top < dirty_top) dirty_top = top;
+        if (bottom > dirty_bottom) dirty_bottom = bottom;
+    }
+
+    return;
+}
+
+void Framebuffer::mark_lit(int left, int top, int right, int bottom)
+{
+    if (left < 0) left = 0;
+    if (top < 0) top = 0;
+    if (right >= width) right = width - 1;
+    if (bottom >= height) bottom = height - 1;
+
+    for (int ty = top / DECAY_TILE; ty <= bottom / DECAY_TILE && top <= bottom; ty++)
+    {
+        for (int tx = left / DECAY_TILE; tx <= right / DECAY_TILE && left <= right; tx++)
+        {
+            lit[ty * tiles_x + tx] = 1;
+        }
+    }
+
+    return;
+}
+
+SDL_Rect Framebuffer::decay(float factor)
+{
+    // Multiplies the colour of every lit tile by factor, truncating so faint pixels always reach black,
+    // and returns the area that changed. Tiles that went black are skipped from then on
+    int left = tiles_x, top = tiles_y, right = -1, bottom = -1;
+#if defined(__SSE2__)
+    // Bytes widened to the high half of 16 bit lanes, so a high multiply by factor in 0.16 fixed point gives v * factor
+    __m128i zero = _mm_setzero_si128();
+    __m128i multiplier = _mm_set1_epi16((short)(Uint16)(factor * 65535));
+    __m128i alpha = _mm_set1_epi32(0xFF000000); // Alpha stays opaque
+#endif
+    for (int ty = 0; ty < tiles_y; ty++)
+    {
+        for (int tx = 0; tx < tiles_x; tx++)
+        {
+            if (!lit[ty * tiles_x + tx]) continue;
+
+            int x0 = tx * DECAY_TILE, x1 = (x0 + DECAY_TILE < width) ? x0 + DECAY_TILE : width;
+            int y0 = ty * DECAY_TILE, y1 = (y0 + DECAY_TILE < height) ? y0 + DECAY_TILE : height;
+            bool any = false;
+            for (int y = y0; y < y1; y++)
+            {
+                Uint8 *row = pixels + ((size_t)y * width + x0) * 4;
+                int x = 0;
+#if defined(__SSE2__)
+                __m128i colours = zero;
+                for (; x + 4 <= x1 - x0; x += 4)
+                {
+                    __m128i quad = _mm_loadu_si128((__m128i*)(row + 4 * x));
+                    __m128i low = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, quad), multiplier);
+                    __m128i high = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, quad), multiplier);
+                    quad = _mm_packus_epi16(_mm_srli_epi16(low, 8), _mm_srli_epi16(high, 8));
+                    colours = _mm_or_si128(colours, _mm_andnot_si128(alpha, quad));
+                    _mm_storeu_si128((__m128i*)(row + 4 * x), _mm_or_si128(quad, alpha));
+                }
+                any = any || _mm_movemask_epi8(_mm_cmpeq_epi8(colours, zero)) != 0xFFFF;
+#endif
+                for (; x < x1 - x0; x++)
+                {
+                    Uint8 *pixel = row + 4 * x;
+                    pixel[0] *= factor;
+                    pixel[1] *= factor;
+                    pixel[2] *= factor;
+                    any = any || pixel[0] || pixel[1] || pixel[2];
+                }
+            }
+            lit[ty * tiles_x + tx] = any;
+
+            if (tx < left) left = tx;
+            if (tx > right) right = tx;
+            if (ty < top) top = ty;
+            if (ty > bottom) bottom = ty;
+        }
+    }
+
+    if (right < 0) return {0, 0, 0, 0};
+    SDL_Rect changed = {left * DECAY_TILE, top * DECAY_TILE, (right - left + 1) * DECAY_TILE, (bottom - top + 1) * DECAY_TILE};
+    mark_dirty(changed.y, changed.y + changed.h - 1);
+    return changed;
+}
+
+void Framebuffer::blend(int x, int y, RGBA colour, float coverage)
+{
+    if (x < 0 || y < 0 || x >= width || y >= height) return;
+
+    // Same result as SDL's blend mode with the colour's alpha scaled by the coverage
+    float a = coverage * colour.a / 255.0f;
+    Uint8 *pixel = pixels + ((size_t)y * width + x) * 4;
+#if defined(__SSE2__)
+    // All four channels at once: widen the bytes to floats, move them towards the colour and narrow back.
+    // Truncates like the scalar version, so both produce the same bytes
+    Sint32 value;
+    memcpy(&value, pixel, 4);
+    __m128i zero = _mm_setzero_si128();
+    __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(value), zero), zero);
+    __m128 destination = _mm_cvtepi32_ps(wide);
+    __m128 source = _mm_setr_ps(colour.r, colour.g, colour.b, 255);
+    __m128 result = _mm_add_ps(destination, _mm_mul_ps(_mm_sub_ps(source, destination), _mm_set1_ps(a)));
+    __m128i narrow = _mm_cvttps_epi32(result);
+    narrow = _mm_packs_epi32(narrow, narrow);
+    narrow = _mm_packus_epi16(narrow, narrow);
+    value = _mm_cvtsi128_si32(narrow);
+    memcpy(pixel, &value, 4);
+#else
+    pixel[0] += (colour.r - pixel[0]) * a;
+    pixel[1] += (colour.g - pixel[1]) * a;
+    pixel[2] += (colour.b - pixel[2]) * a;
+    pixel[3] += (255 - pixel[3]) * a;
+#endif
+
+    return;
+}
+
+void Framebuffer::draw_line(RGBA colour, float x0, float y0, float x1, float y1)
+{
+    mark_dirty((int)floor(fmin(y0, y1)) - 1, (int)floor(fmax(y0, y1)) + 2);
+    mark_lit((int)floor(fmin(x0, x1)) - 1, (int)floor(fmin(y0, y1)) - 1, (int)floor(fmax(x0, x1)) + 2, (int)floor(fmax(y0, y1)) + 2);
+
+    auto plot = [this, colour](int x, int y, float coverage) -> void {
+        blend(x, y, colour, coverage);
+        return;
+    };
+    SDL_Rect clip = {0, 0, width, height};
+#if defined(__SSE2__)
+    // The coverage of four columns between the endpoints at once, SSE2 has no floor so truncate and step down
+    // where that rounded up. The columns left over go one at a time
+    wu_line(x0, y0, x1, y1, &clip, plot, [&plot](int first, int from, int last, float intery, float gradient, bool steep) -> void {
+        __m128 lanes = _mm_setr_ps(0, 1, 2, 3);
+        __m128 one = _mm_set1_ps(1);
+        int x = from;
+        for (; x + 3 < last; x += 4)
+        {
+            __m128 column = _mm_add_ps(_mm_set1_ps((float)(x - first)), lanes);
+            __m128 y = _mm_add_ps(_mm_set1_ps(intery), _mm_mul_ps(column, _mm_set1_ps(gradient)));
+            __m128 whole = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+            whole = _mm_sub_ps(whole, _mm_and_ps(_mm_cmpgt_ps(whole, y), one));
+            __m128 below = _mm_sub_ps(y, whole);
+            __m128 above = _mm_sub_ps(one, below);
+
+            Sint32 rows[4];
+            float upper[4], lower[4];
+            _mm_storeu_si128((__m128i*)rows, _mm_cvttps_epi32(whole));
+            _mm_storeu_ps(upper, above);
+            _mm_storeu_ps(lower, below);
+            for (int k = 0; k < 4; k++)
+            {
+                plot(steep ? rows[k] : x + k, steep ? x + k : rows[k], upper[k]);
+                plot(steep ? rows[k] + 1 : x + k, steep ? x + k : rows[k] + 1, lower[k]);
+            }
+        }
+        wu_columns(first, x, last, intery, gradient, steep, plot);
+        return;
+    });
+#else
+    wu_line(x0, y0, x1, y1, &clip, plot);
+#endif
+
+    return;
+}
+
+void Framebuffer::fill_span(int y, int x0, int x1, RGBA colour)
+{
+    if (y < 0 || y >= height) return;
+    if (x0 < 0) x0 = 0;
+    if (x1 >= width) x1 = width - 1;
+    if (x0 > x1) return;
+
+    if (colour.a < 255)
+    {
+        for (int x = x0; x <= x1; x++) blend(x, y, colour, 1);
+        return;
+    }
+
+    // Opaque and fully covered, so the whole span is just the colour
+    Uint8 pixel[4] = {(Uint8)colour.r, (Uint8)colour.g, (Uint8)colour.b, 255};
+    Uint32 value;
+    memcpy(&value, pixel, 4);
+    SDL_memset4(pixels + ((size_t)y * width + x0) * 4, value, x1 - x0 + 1);
+
+    return;
+}
+
+void Framebuffer::draw_stroke(RGBA colour, float x0, float y0, float x1, float y1, float width, const Vec2Float *previous)
+{
+    float reach = width / 2 + 1;
+    mark_dirty((int)floor(fmin(y0, y1) - reach), (int)ceil(fmax(y0, y1) + reach));
+    mark_lit((int)floor(fmin(x0, x1) - reach), (int)floor(fmin(y0, y1) - reach), (int)ceil(fmax(x0, x1) + reach), (int)ceil(fmax(y0, y1) + reach));
+
+    SDL_Rect clip = {0, 0, this->width, height};
+    stroke_segment(x0, y0, x1, y1, width, previous, &clip,
+        [this, colour](int x, int y, float coverage) -> void {
+            blend(x, y, colour, coverage);
+            return;
+        },
+        [this, colour](int y, int first, int last) -> void {
+            fill_span(y, first, last, colour);
+            return;
+        });
+
+    return;
+}
+
+void Framebuffer::upload(SDL_Texture *texture)
+{
+    // Copy only the rows drawn to since the last upload into the streaming texture
+    if (dirty_top > dirty_bottom) return;
+
+    SDL_Rect rows = {0, dirty_top, width, dirty_bottom - dirty_top + 1};
+    void *destination;
+    int pitch;
+    if (SDL_LockTexture(texture, &rows, &destination, &pitch) == 0)
+    {
+        for (int y = 0; y < rows.h; y++)
+        {
+            memcpy((Uint8*)destination + (size_t)y * pitch, pixels + ((size_t)(rows.y + y) * width) * 4, (size_t)width * 4);
+        }
+        SDL_UnlockTexture(texture);
+    }
+    dirty_top = 0;
+    dirty_bottom = -1;
+
+    return;
+}
+
+bool Framebuffer::save_bmp(const char *path)
+{
+    // Surfaces work without initializing SDL's video subsystem
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(pixels, width, height, 32, width * 4, SDL_PIXELFORMAT_RGBA32);
+    if (surface == NULL || SDL_SaveBMP(surface, path) != 0)
+    {
+        printf("Failed to save %s: %s\n", path, SDL_GetError());
+        SDL_FreeSurface(surface);
+        return false;
+    }
+    SDL_FreeSurface(surface);
+
+    return true;
+}
+
+void Framebuffer::free_members()
+{
+    free(pixels);
+    free(lit);
+    pixels = NULL;
+    lit = NULL;
+    width = height = 0;
+
+    return;
+}
+
+// * DensityBuffer method definitions
+DensityBuffer::DensityBuffer()
+{
+    width = height = 0;
+    cells = NULL;
+    reached = NULL;
+    counted = NULL;
+    along = 0;
+}
+
+void DensityBuffer::create(int w, int h)
+{
+    width = w;
+    height = h;
+    cells = (float*)realloc(cells, sizeof(float) * 4 * width * height);
+    if (cells == NULL)
+    {
+        printf("Failed to allocate memory to a %dx%d density buffer\n", width, height);
+        exit(1);
+    }
+
+    return;
+}
+
+void DensityBuffer::clear()
+{
+    memset(cells, 0, sizeof(float) * 4 * width * height);
+    if (reached != NULL)
+    {
+        memset(reached, 0, sizeof(double) * width * height);
+        memset(counted, 0, sizeof(float) * width * height);
+    }
+    along = 0;
+
+    return;
+}
+
+void DensityBuffer::accumulate(int x, int y, RGBA colour, float coverage)
+{
+    if (x < 0 || y < 0 || x >= width || y >= height) return;
+
+    float *cell = cells + ((size_t)y * width + x) * 4;
+#if defined(__SSE2__)
+    // The whole cell in one register
+    __m128 weighted = _mm_mul_ps(_mm_setr_ps(colour.r, colour.g, colour.b, 1), _mm_set1_ps(coverage));
+    _mm_storeu_ps(cell, _mm_add_ps(_mm_loadu_ps(cell), weighted));
+#else
+    cell[0] += colour.r * coverage;
+    cell[1] += colour.g * coverage;
+    cell[2] += colour.b * coverage;
+    cell[3] += coverage;
+#endif
+
+    return;
+}
+
+void DensityBuffer::draw_line(RGBA colour, float x0, float y0, float x1, float y1)
+{
+    SDL_Rect clip = {0, 0, width, height};
+    wu_line(x0, y0, x1, y1, &clip, [this, colour](int x, int y, float coverage) -> void {
+        accumulate(x, y, colour, coverage);
+        return;
+    });
+
+    return;
+}
+
+void DensityBuffer::draw_stroke(RGBA colour, float x0, float y0, float x1, float y1, float width, const Vec2Float *previous, bool count)
+{
+    if (reached == NULL)
+    {
+        reached = (double*)calloc((size_t)this->width * height, sizeof(double));
+        counted = (float*)calloc((size_t)this->width * height, sizeof(float));
+        if (reached == NULL || counted == NULL)
+        {
+            printf("Failed to allocate memory to a %dx%d density buffer\n", this->width, height);
+            exit(1);
+        }
+    }
+
+    // A stroke covers a pixel over and over while it passes, so within one pass a pixel only adds what it is covered
+    // beyond the most counted so far. The pass ends once the stroke has gone on further than it is wide without
+    // covering the pixel, or when the trail breaks off. Without counting, only the coverage is recorded, so a slice
+    // can pick up where the one before it left off
+    float window = width + 1;
+    if (previous == NULL) along += window + 1;
+    double start = along, end = along + hypotf(x1 - x0, y1 - y0);
+    auto cover = [&](int x, int y, float coverage) -> void {
+        if (x < 0 || y < 0 || x >= this->width || y >= height) return;
+
+        size_t p = (size_t)y * this->width + x;
+        float added = coverage;
+        if (start - reached[p] <= window) added -= counted[p];
+        if (added > 0) counted[p] = coverage;
+        reached[p] = end;
+        if (count && added > 0) accumulate(x, y, colour, added);
+        return;
+    };
+    SDL_Rect clip = {0, 0, this->width, height};
+    stroke_segment(x0, y0, x1, y1, width, NULL, &clip, cover,
+        [&](int y, int first, int last) -> void {
+            for (int x = first; x <= last; x++) cover(x, y, 1);
+            return;
+        });
+    along = end;
+
+    return;
+}
+
+void DensityBuffer::add(DensityBuffer *other)
+{
+    // Sums are order independent, so buffers filled by different threads can simply be added up
+    size_t length = (size_t)4 * width * height;
+    size_t i = 0;
+    for (; i + SIMD_WIDTH <= length; i += SIMD_WIDTH)
+    {
+        simd_storeu(cells + i, simd_add(simd_loadu(cells + i), simd_loadu(other->cells + i)));
+    }
+    for (; i < length; i++)
+    {
+        cells[i] += other->cells[i];
+    }
+
+    return;
+}
+
+void DensityBuffer::tone_map(enum ToneMap mode, Framebuffer *out)
+{
+    out->create(width, height);
+    size_t pixels = (size_t)width * height;
+    float max_density = 0;
+    for (size_t i = 0; i < pixels; i++)
+    {
+        max_density = fmaxf(max_density, cells[4 * i + 3]);
+    }
+    float log_max = log1pf(max_density);
+
+    // Equalization maps each density to its rank among the lit pixels, binned on a log scale so the faint passes
+    // don't all share the first bin
+    float *levels = NULL;
+    if (mode == TONE_MAP_EQUALIZE && max_density > 0)
+    {
+        long long *histogram = (long long*)calloc(DENSITY_HISTOGRAM_BINS, sizeof(long long));
+        levels = (float*)malloc(sizeof(float) * DENSITY_HISTOGRAM_BINS);
+        if (histogram == NULL || levels == NULL)
+        {
+            printf("Failed to allocate memory to the density histogram\n");
+            exit(1);
+        }
+        long long lit = 0;
+        for (size_t i = 0; i < pixels; i++)
+        {
+            if (cells[4 * i + 3] <= 0) continue;
+            histogram[(int)(log1pf(cells[4 * i + 3]) / log_max * (DENSITY_HISTOGRAM_BINS - 1))]++;
+            lit++;
+        }
+        long long running = 0;
+        for (int bin = 0; bin < DENSITY_HISTOGRAM_BINS; bin++)
+        {
+            running += histogram[bin];
+            levels[bin] = running / (float)lit;
+        }
+        free(histogram);
+    }
+
+    for (size_t i = 0; i < pixels; i++)
+    {
+        float *cell = cells + 4 * i;
+        Uint8 *pixel = out->pixels + 4 * i;
+        pixel[0] = pixel[1] = pixel[2] = 0;
+        pixel[3] = 255;
+        if (cell[3] <= 0) continue;
+
+        float brightness;
+        if (mode == TONE_MAP_LOG) brightness = log1pf(cell[3]) / log_max;
+        else if (mode == TONE_MAP_GAMMA) brightness = powf(cell[3] / max_density, 1 / DENSITY_GAMMA);
+        else brightness = levels[(int)(log1pf(cell[3]) / log_max * (DENSITY_HISTOGRAM_BINS - 1))];
+
+        // Average colour of the passes over the pixel, at the mapped brightness
+        float scale = brightness / cell[3];
+        pixel[0] = fminf(255, cell[0] * scale);
+        pixel[1] = fminf(255, cell[1] * scale);
+        pixel[2] = fminf(255, cell[2] * scale);
+    }
+    free(levels);
+
+    return;
+}
+
+void DensityBuffer::free_members()
+{
+    free(cells);
+    free(reached);
+    free(counted);
+    cells = NULL;
+    reached = NULL;
+    counted = NULL;
+    width = height = 0;
+
+    return;
+}
+
+// * Preview method definitions
+Preview::Preview() : cancel(false)
+{
+    revision = (unsigned long)-1; // Anything but the first scene revision
+    curves_length = 0;
+    curve_nodes = NULL;
+    pending = drawing = {NULL, 0, 0, NULL, 0};
+    drawing_curve = 0;
+    drawing_point = 0;
+    textures[0] = textures[1] = NULL;
+    front = 0;
+}
+
+void Preview::update(Spirograph *root)
+{
+    if (revision != editorState.scene_revision)
+    {
+        // Cancel the job for the old scene and start over from a snapshot of the new one. Levels the old job
+        // already published are kept, so the last curve stays on the screen until the new job has one
+        stop();
+        tree.compile(root);
+        revision = editorState.scene_revision;
+        worker = std::thread(&Preview::compute, this);
+    }
+
+    return;
+}
+
+void Preview::compute()
+{
+    // Runs on the worker thread and only touches the snapshot and the levels it creates
+    evaluator.compile(&tree);
+    long long closure_samples;
+    double fine_step = fixed_step(&tree, &evaluator, PREVIEW_MAX_SEGMENT_LENGTH, &closure_samples);
+    double duration = (closure_samples >= 0) ? closure_samples * fine_step : SWEEP_DURATION;
+
+    curves_length = 0;
+    curve_nodes = (int*)realloc(curve_nodes, sizeof(int) * tree.nodes_length);
+    if (curve_nodes == NULL)
+    {
+        printf("Failed to allocate memory to the preview\n");
+        exit(1);
+    }
+    for (int i = 0; i < tree.nodes_length; i++)
+    {
+        if (tree.trail_on[i]) curve_nodes[curves_length++] = i;
+    }
+    if (curves_length == 0)
+    {   // Nothing to preview, an empty level clears the curve on the screen
+        publish({NULL, 1, 0, NULL, revision});
+        return;
+    }
+
+    // A level of n segments has n + 1 samples at t = k * duration / n
+    long segments = PREVIEW_COARSE_SAMPLES;
+    PreviewLevel level = {NULL, 0, curves_length, NULL, revision};
+    const int chunk = 16 * PHASOR_BLOCK; // Work in chunks so a cancelled job stops quickly
+    Vec2Float odd[chunk];
+    while (true)
+    {
+        PreviewLevel next = {(Vec2Float*)malloc(sizeof(Vec2Float) * curves_length * (segments + 1)), segments + 1, curves_length, NULL, revision};
+        if (next.points == NULL)
+        {
+            printf("Failed to allocate memory to the preview\n");
+            exit(1);
+        }
+
+        double step = duration / segments;
+        for (int c = 0; c < curves_length; c++)
+        {
+            Vec2Float *curve = next.points + c * next.samples;
+            if (level.points == NULL)
+            {   // Coarsest level, every sample is new
+                for (long first = 0; first < next.samples; first += chunk)
+                {
+                    if (cancel) break;
+                    int n = (next.samples - first < chunk) ? next.samples - first : chunk;
+                    evaluator.tips(curve_nodes[c], 0, step, first, n, curve + first);
+                }
+            }
+            else
+            {   // Even samples come from the previous level, only the odd ones in between are evaluated
+                Vec2Float *previous = level.points + c * level.samples;
+                for (long k = 0; k < level.samples; k++)
+                {
+                    curve[2 * k] = previous[k];
+                }
+                for (long first = 0; first < level.samples - 1; first += chunk)
+                {
+                    if (cancel) break;
+                    int n = (level.samples - 1 - first < chunk) ? level.samples - 1 - first : chunk;
+                    evaluator.tips(curve_nodes[c], step, 2 * step, first, n, odd);
+                    for (int k = 0; k < n; k++)
+                    {
+                        curve[2 * (first + k) + 1] = odd[k];
+                    }
+                }
+            }
+        }
+        free(level.points);
+        level = next;
+        if (cancel) break;
+
+        publish(level);
+        if (step <= fine_step || 2 * segments + 1 > PREVIEW_MAX_SAMPLES) break;
+        segments *= 2;
+    }
+    free(level.points);
+
+    return;
+}
+
+void Preview::publish(PreviewLevel level)
+{
+    // The main thread gets its own copy with the curve colours, replacing a level it has not picked up yet.
+    // The copy is never empty, so even a level without curves is picked up
+    long length = curves_length * level.samples;
+    PreviewLevel copy = {(Vec2Float*)malloc(sizeof(Vec2Float) * (length ? length : 1)), level.samples, curves_length,
+                         (RGBA*)malloc(sizeof(RGBA) * (curves_length ? curves_length : 1)), level.revision};
+    if (copy.points == NULL || copy.colours == NULL)
+    {
+        printf("Failed to allocate memory to the preview\n");
+        exit(1);
     }
-    else if (hovering_head)
-    {   // Highlight the head when it's being hovered by increasing the radius
-        selected_node->head_radius = selected_node->hover_radius;
-        selected_node->draw_head(Spirograph::HIGHLIGHT);
+    if (length) memcpy(copy.points, level.points, sizeof(Vec2Float) * length);
+    for (int c = 0; c < curves_length; c++)
+    {
+        copy.colours[c] = tree.trail_colour[curve_nodes[c]];
     }
-    else if (holding_head)
-    {   // Fix the direction vector on mouse position
-        selected_node->direction_initial = selected_node->direction = {MouseState.pos.x - selected_node->position_initial.x, MouseState.pos.y - selected_node->position_initial.y};
+
+    std::lock_guard<std::mutex> guard(pending_mutex);
+    free_level(&pending);
+    pending = copy;
+
+    return;
+}
+
+void Preview::free_level(PreviewLevel *level)
+{
+    free(level->points);
+    free(level->colours);
+    *level = {NULL, 0, 0, NULL, 0};
+
+    return;
+}
+
+void Preview::stop()
+{
+    if (worker.joinable())
+    {
+        cancel = true;
+        worker.join();
+        cancel = false;
     }
-    
-    // Change position based on base state
-    if (!hovering_base && !holding_base)
+
+    return;
+}
+
+void Preview::draw()
+{
+    for (int i = 0; i < 2; i++)
     {
-        selected_node->base_radius = selected_node->default_radius;
+        if (textures[i]) continue;
+        textures[i] = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, display.width, display.height);
+        SDL_SetTextureBlendMode(textures[i], SDL_BLENDMODE_BLEND);
+        SDL_SetTextureAlphaMod(textures[i], PREVIEW_ALPHA);
+        SDL_SetRenderTarget(renderer, textures[i]);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        SDL_RenderClear(renderer);
+        SDL_SetRenderTarget(renderer, NULL);
     }
-    else if (hovering_base && !selected_node->is_root)
-    {   // Highlight the base when it's being hovered by increasing the radius
-        selected_node->base_radius = selected_node->hover_radius;
-        selected_node->draw_base(Spirograph::HIGHLIGHT);
+
+    // Pick up the newest level once the previous one is fully drawn, or right away if the scene changed since
+    {
+        std::lock_guard<std::mutex> guard(pending_mutex);
+        if (pending.points && (drawing.points == NULL || pending.revision != drawing.revision))
+        {
+            free_level(&drawing);
+            drawing = pending;
+            pending = {NULL, 0, 0, NULL, 0};
+            drawing_curve = 0;
+            drawing_point = 0;
+        }
     }
-    else if (holding_base)
-    {   // Fix the position vector on the orthogonal porjection of the mouse position on the parent direction
-        // Get parent orthogonal projection taking direction vector boundaries into account
-        Vec2Float parent_orthproj = selected_node->parent->get_cursor_orthogonalProjection();
-        float proj_scale = parent_orthproj.x ? parent_orthproj.x / selected_node->parent->direction_initial.x : parent_orthproj.y / selected_node->parent->direction_initial.y;
-        if (proj_scale <= 0) 
+
+    if (drawing.points)
+    {
+        SDL_Texture *back = textures[1 - front];
+        SDL_SetRenderTarget(renderer, back);
+        if (drawing_curve == 0 && drawing_point == 0)
         {
-            proj_scale = 0;
-            parent_orthproj = {0, 0};
+            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+            SDL_RenderClear(renderer);
         }
-        else if (proj_scale >= 1)
+
+        // Draw up to the per frame budget, consecutive slices share their end point
+        long budget = PREVIEW_POINTS_PER_FRAME;
+        while (budget > 0 && drawing_curve < drawing.curves)
         {
-            proj_scale = 1;
-            parent_orthproj = selected_node->parent->direction_initial;
+            long n = drawing.samples - drawing_point;
+            if (n > budget) n = budget;
+            SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(drawing.colours[drawing_curve]));
+            SDL_RenderDrawLinesF(renderer, (SDL_FPoint*)(drawing.points + drawing_curve * drawing.samples + drawing_point), n);
+            budget -= n;
+            drawing_point += n - 1;
+            if (drawing_point >= drawing.samples - 1)
+            {
+                drawing_curve++;
+                drawing_point = 0;
+            }
+        }
+        SDL_SetRenderTarget(renderer, NULL);
+
+        // Show the level once it is complete
+        if (drawing_curve >= drawing.curves)
+        {
+            front = 1 - front;
+            free_level(&drawing);
         }
-        
-        // Set new position and recalculate positionon parent
-        selected_node->position_initial = selected_node->position = {selected_node->parent->position_initial.x + parent_orthproj.x, selected_node->parent->position_initial.y + parent_orthproj.y};
-        selected_node->position_on_parent = proj_scale;
     }
 
-    // Update children's position based on the new direction
-    if (holding_head || holding_base)
+    damage_layer(textures[front], {0, 0, display.width, display.height}, false); // A flip swaps the layer's texture, which damages it
+
+    return;
+}
+
+void Preview::free_members()
+{
+    stop();
+    tree.free_members();
+    evaluator.free_members();
+    free(curve_nodes);
+    free_level(&pending);
+    free_level(&drawing);
+    for (int i = 0; i < 2; i++)
     {
-        selected_node->update_childrens_position_on_parent();
+        if (textures[i]) SDL_DestroyTexture(textures[i]);
+        textures[i] = NULL;
     }
+    curve_nodes = NULL;
+    curves_length = 0;
 
-    *editing = (hovering_base || holding_base || hovering_head || holding_head);
+    return;
+}
+
+// * LineBatch method definitions
+LineBatch::LineBatch()
+{
+    buckets = NULL;
+    buckets_length = buckets_capacity = 0;
+    points = draw_calls = 0;
+}
+
+LineBatchBucket *LineBatch::find_bucket(RGBA colour)
+{
+    // Lines usually come in long runs of the same colour
+    int b = buckets_length - 1;
+    while (b >= 0 && memcmp(&buckets[b].colour, &colour, sizeof(RGBA))) b--;
+    if (b < 0)
+    {
+        if (buckets_length == buckets_capacity)
+        {
+            buckets_capacity = buckets_capacity ? 2 * buckets_capacity : 8;
+            buckets = (LineBatchBucket*)realloc(buckets, sizeof(LineBatchBucket) * buckets_capacity);
+            if (buckets == NULL)
+            {
+                printf("Failed to allocate memory to the line batch\n");
+                exit(1);
+            }
+        }
+        b = buckets_length++;
+        memset(&buckets[b], 0, sizeof(LineBatchBucket));
+        buckets[b].colour = colour;
+    }
+
+    return &buckets[b];
+}
+
+void LineBatch::add_point(LineBatchBucket *bucket, int x, int y, float coverage)
+{
+    int level = coverage * (LINE_BATCH_LEVELS - 1) + 0.5f;
+    if (level <= 0) return;
+
+    if (bucket->points_length[level] == bucket->points_capacity[level])
+    {
+        bucket->points_capacity[level] = bucket->points_capacity[level] ? 2 * bucket->points_capacity[level] : 256;
+        bucket->points[level] = (SDL_FPoint*)realloc(bucket->points[level], sizeof(SDL_FPoint) * bucket->points_capacity[level]);
+        if (bucket->points[level] == NULL)
+        {
+            printf("Failed to allocate memory to the line batch\n");
+            exit(1);
+        }
+    }
+    bucket->points[level][bucket->points_length[level]++] = {(float)x, (float)y};
+    points++;
 
     return;
 }
 
-void node_near_cursor_orthproj(Spirograph *spirograph_base_node, Spirograph **closest, float *distance2, Vec2Float *orthproj)
+void LineBatch::add_span(LineBatchBucket *bucket, int y, int first, int last)
 {
-    *closest = spirograph_base_node;
+    if (bucket->spans_length == bucket->spans_capacity)
+    {
+        bucket->spans_capacity = bucket->spans_capacity ? 2 * bucket->spans_capacity : 64;
+        bucket->spans = (SDL_FRect*)realloc(bucket->spans, sizeof(SDL_FRect) * bucket->spans_capacity);
+        if (bucket->spans == NULL)
+        {
+            printf("Failed to allocate memory to the line batch\n");
+            exit(1);
+        }
+    }
+    bucket->spans[bucket->spans_length++] = {(float)first, (float)y, (float)(last - first + 1), 1};
+    points += last - first + 1;
 
-    // Calculate orthogonal projection distance from cursor
-    *orthproj = spirograph_base_node->get_cursor_orthogonalProjection();
-    float proj_scale = orthproj->x ? orthproj->x / spirograph_base_node->direction_initial.x : orthproj->y / spirograph_base_node->direction_initial.y;
+    return;
+}
 
-    // Bounds for the orthogonal projection
-    if (proj_scale <= 0)
+void LineBatch::add_line(RGBA colour, float x0, float y0, float x1, float y1)
+{
+    LineBatchBucket *bucket = find_bucket(colour);
+    wu_line(x0, y0, x1, y1, NULL, [this, bucket](int x, int y, float coverage) -> void {
+        add_point(bucket, x, y, coverage);
+        return;
+    });
+
+    return;
+}
+
+void LineBatch::add_stroke(RGBA colour, float x0, float y0, float x1, float y1, float width, const Vec2Float *previous)
+{
+    LineBatchBucket *bucket = find_bucket(colour);
+    stroke_segment(x0, y0, x1, y1, width, previous, NULL,
+        [this, bucket](int x, int y, float coverage) -> void {
+            add_point(bucket, x, y, coverage);
+            return;
+        },
+        [this, bucket](int y, int first, int last) -> void {
+            add_span(bucket, y, first, last);
+            return;
+        });
+
+    return;
+}
+
+void LineBatch::flush(SDL_Renderer *renderer)
+{
+    for (int b = 0; b < buckets_length; b++)
     {
-        *orthproj = {0, 0};
+        if (buckets[b].spans_length > 0)
+        {
+            SDL_SetRenderDrawColor(renderer, buckets[b].colour.r, buckets[b].colour.g, buckets[b].colour.b, 255);
+            SDL_RenderFillRectsF(renderer, buckets[b].spans, buckets[b].spans_length);
+            buckets[b].spans_length = 0;
+            draw_calls++;
+        }
+        for (int level = 1; level < LINE_BATCH_LEVELS; level++)
+        {
+            if (buckets[b].points_length[level] == 0) continue;
+            SDL_SetRenderDrawColor(renderer, buckets[b].colour.r, buckets[b].colour.g, buckets[b].colour.b, 255 * level / (LINE_BATCH_LEVELS - 1));
+            SDL_RenderDrawPointsF(renderer, buckets[b].points[level], buckets[b].points_length[level]);
+            buckets[b].points_length[level] = 0;
+            draw_calls++;
+        }
+    }
+
+    return;
+}
+
+void LineBatch::free_members()
+{
+    for (int b = 0; b < buckets_length; b++)
+    {
+        for (int level = 0; level < LINE_BATCH_LEVELS; level++)
+        {
+            free(buckets[b].points[level]);
+        }
+        free(buckets[b].spans);
+    }
+    free(buckets);
+    buckets = NULL;
+    buckets_length = buckets_capacity = 0;
+
+    return;
+}
+
+// * CircleSprites method definitions
+CircleSprites::CircleSprites()
+{
+    atlas = NULL;
+    atlas_width = atlas_height = 0;
+    vertices = NULL;
+    indices = NULL;
+    quads_length = quads_capacity = 0;
+}
+
+void CircleSprites::create(SDL_Renderer *renderer)
+{
+    // One row of outlines and one of filled circles, one pixel of padding around each sprite
+    atlas_width = 0;
+    for (int radius = 0; radius <= SPRITE_MAX_RADIUS; radius++)
+    {
+        int size = 2 * radius + 1;
+        sprites[0][radius] = {atlas_width, 0, size, size};
+        sprites[1][radius] = {atlas_width, 2 * SPRITE_MAX_RADIUS + 2, size, size};
+        atlas_width += size + 1;
+    }
+    atlas_height = 2 * (2 * SPRITE_MAX_RADIUS + 2);
+
+    atlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, atlas_width, atlas_height);
+    if (atlas == NULL) return; // add() falls back to drawing the circles directly
+
+    // Rasterize with the same circle functions the sprites replace so they look identical
+    SDL_SetRenderTarget(renderer, atlas);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
+    SDL_SetRenderDrawColor(renderer, WHITE);
+    for (int radius = 0; radius <= SPRITE_MAX_RADIUS; radius++)
+    {
+        SDL_RenderDrawCircle(renderer, sprites[0][radius].x + radius, sprites[0][radius].y + radius, radius);
+        SDL_RenderFillCircle(renderer, sprites[1][radius].x + radius, sprites[1][radius].y + radius, radius);
+    }
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderTarget(renderer, NULL);
+    SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+
+    return;
+}
+
+void CircleSprites::add(RGBA colour, int x, int y, int radius, bool filled)
+{
+    damage_overlay({x - radius - 1, y - radius - 1, 2 * radius + 3, 2 * radius + 3});
+    if (atlas == NULL || radius < 0 || radius > SPRITE_MAX_RADIUS)
+    {
+        SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(colour));
+        if (filled) SDL_RenderFillCircle(renderer, x, y, radius);
+        else SDL_RenderDrawCircle(renderer, x, y, radius);
+        return;
+    }
+
+    if (quads_length == quads_capacity)
+    {
+        quads_capacity = quads_capacity ? 2 * quads_capacity : 64;
+        vertices = (SDL_Vertex*)realloc(vertices, sizeof(SDL_Vertex) * 4 * quads_capacity);
+        indices = (int*)realloc(indices, sizeof(int) * 6 * quads_capacity);
+        if (vertices == NULL || indices == NULL)
+        {
+            printf("Failed to allocate memory to circle sprites\n");
+            exit(1);
+        }
+    }
+
+    // Quad covering the sprite's pixels exactly, so nearest sampling copies it 1:1
+    SDL_Rect sprite = sprites[filled][radius];
+    SDL_Color tint = {(Uint8)colour.r, (Uint8)colour.g, (Uint8)colour.b, (Uint8)colour.a};
+    float left = x - radius, top = y - radius, right = left + sprite.w, bottom = top + sprite.h;
+    float u0 = (float)sprite.x / atlas_width, v0 = (float)sprite.y / atlas_height;
+    float u1 = (float)(sprite.x + sprite.w) / atlas_width, v1 = (float)(sprite.y + sprite.h) / atlas_height;
+
+    SDL_Vertex *quad = vertices + 4 * quads_length;
+    quad[0] = {{left, top}, tint, {u0, v0}};
+    quad[1] = {{right, top}, tint, {u1, v0}};
+    quad[2] = {{left, bottom}, tint, {u0, v1}};
+    quad[3] = {{right, bottom}, tint, {u1, v1}};
+
+    int *quad_indices = indices + 6 * quads_length;
+    int first = 4 * quads_length;
+    quad_indices[0] = first;
+    quad_indices[1] = first + 1;
+    quad_indices[2] = first + 2;
+    quad_indices[3] = first + 2;
+    quad_indices[4] = first + 1;
+    quad_indices[5] = first + 3;
+    quads_length++;
+
+    return;
+}
+
+void CircleSprites::flush(SDL_Renderer *renderer)
+{
+    // Draw queued sprites in the order they were added
+    if (quads_length == 0) return;
+    SDL_RenderGeometry(renderer, atlas, vertices, 4 * quads_length, indices, 6 * quads_length);
+    quads_length = 0;
+
+    return;
+}
+
+void CircleSprites::free_members()
+{
+    if (atlas) SDL_DestroyTexture(atlas);
+    free(vertices);
+    free(indices);
+    atlas = NULL;
+    vertices = NULL;
+    indices = NULL;
+    quads_length = quads_capacity = 0;
+
+    return;
+}
+
+// * TrailPyramid method definitions
+TrailPyramid::TrailPyramid()
+{
+    texture = NULL;
+    frame = 0;
+    changed = true;
+    for (int i = 0; i < TRAIL_TILE_CACHE; i++)
+    {
+        tiles[i].ready = false;
+        tiles[i].used = 0;
+        tiles[i].texture = NULL;
+    }
+}
+
+void TrailPyramid::create(SDL_Renderer *renderer)
+{
+    // Tiles are only allocated once the view is zoomed or panned
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, display.width, display.height);
+
+    return;
+}
+
+TrailTile *TrailPyramid::find(int level, int x, int y)
+{
+    for (int i = 0; i < TRAIL_TILE_CACHE; i++)
+    {
+        TrailTile *tile = &tiles[i];
+        if (tile->ready && tile->level == level && tile->x == x && tile->y == y) return tile;
+    }
+
+    return NULL;
+}
+
+TrailTile *TrailPyramid::rasterize(CompiledTree *tree, int level, int x, int y)
+{
+    // Replace an empty tile, or the one drawn longest ago
+    TrailTile *tile = &tiles[0];
+    for (int i = 1; i < TRAIL_TILE_CACHE && tile->ready; i++)
+    {
+        if (!tiles[i].ready || tiles[i].used < tile->used) tile = &tiles[i];
+    }
+    if (tile->texture == NULL)
+    {
+        tile->framebuffer.create(TRAIL_TILE_SIZE, TRAIL_TILE_SIZE);
+        tile->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, TRAIL_TILE_SIZE, TRAIL_TILE_SIZE);
+        SDL_SetTextureScaleMode(tile->texture, SDL_ScaleModeLinear);
+    }
+
+    // Only the history chunks reaching into the tile are decoded
+    float scale = ldexpf(1, level);
+    SDL_Rect area = {0, 0, TRAIL_TILE_SIZE, TRAIL_TILE_SIZE};
+    PolylineSimplifier simplifier;
+    simplifier.create(simulation.tolerance);
+    tile->framebuffer.clear({BLACK});
+    for (int i = 0; i < tree->nodes_length; i++)
+    {
+        if (tree->trails[i]) tree->trails[i]->rasterize(&tile->framebuffer, scale, {-x * (float)TRAIL_TILE_SIZE, -y * (float)TRAIL_TILE_SIZE}, &area, &simplifier);
+    }
+    tile->level = level;
+    tile->x = x;
+    tile->y = y;
+    tile->ready = true;
+    tile->used = frame;
+
+    return tile;
+}
+
+void TrailPyramid::add_new_points(Trail *trail)
+{
+    if (trail->new_points_length == 0) return;
+
+    // Draw the new segments into every cached tile they reach
+    Vec2Float low = trail->current_point, high = trail->current_point;
+    for (int k = 0; k < trail->new_points_length; k++)
+    {
+        low = {fminf(low.x, trail->new_points[k].x), fminf(low.y, trail->new_points[k].y)};
+        high = {fmaxf(high.x, trail->new_points[k].x), fmaxf(high.y, trail->new_points[k].y)};
+    }
+    for (int i = 0; i < TRAIL_TILE_CACHE; i++)
+    {
+        TrailTile *tile = &tiles[i];
+        if (!tile->ready) continue;
+        float scale = ldexpf(1, tile->level);
+        float margin = trail->width * scale / 2 + 2;
+        float left = tile->x * (float)TRAIL_TILE_SIZE, top = tile->y * (float)TRAIL_TILE_SIZE;
+        if (high.x * scale + margin < left || low.x * scale - margin >= left + TRAIL_TILE_SIZE ||
+            high.y * scale + margin < top || low.y * scale - margin >= top + TRAIL_TILE_SIZE) continue;
+        trail->draw_new_points(&tile->framebuffer, scale, {-left, -top});
+    }
+
+    return;
+}
+
+void TrailPyramid::fade(float factor)
+{
+    for (int i = 0; i < TRAIL_TILE_CACHE; i++)
+    {
+        if (tiles[i].ready) tiles[i].framebuffer.decay(factor);
+    }
+
+    return;
+}
+
+void TrailPyramid::clear()
+{
+    for (int i = 0; i < TRAIL_TILE_CACHE; i++)
+    {
+        tiles[i].ready = false;
+    }
+    changed = true;
+
+    return;
+}
+
+bool TrailPyramid::compose(SDL_Renderer *renderer, CompiledTree *tree)
+{
+    // The level with at least one tile pixel per screen pixel, drawn scaled down by up to half
+    frame++;
+    int level = ceilf(log2f(view.zoom));
+    if (level < VIEW_MIN_LEVEL) level = VIEW_MIN_LEVEL;
+    if (level > VIEW_MAX_LEVEL) level = VIEW_MAX_LEVEL;
+    float size = TRAIL_TILE_SIZE / ldexpf(1, level) * view.zoom; // Screen pixels per tile
+    int first_x = floorf(-view.offset.x / size), last_x = floorf((display.width - view.offset.x) / size);
+    int first_y = floorf(-view.offset.y / size), last_y = floorf((display.height - view.offset.y) / size);
+
+    // Keep the visible tiles and the coarser ones standing in for missing tiles, then rasterize a few of the missing ones
+    auto stand_in = [this, level](int x, int y, SDL_Rect *source) -> TrailTile* {
+        for (int d = 1; d <= 8 && level - d >= VIEW_MIN_LEVEL; d++)
+        {
+            TrailTile *tile = find(level - d, x >> d, y >> d);
+            if (tile == NULL) continue;
+            int part = TRAIL_TILE_SIZE >> d;
+            *source = {(x & ((1 << d) - 1)) * part, (y & ((1 << d) - 1)) * part, part, part};
+            return tile;
+        }
+        return NULL;
+    };
+    for (int y = first_y; y <= last_y; y++)
+    {
+        for (int x = first_x; x <= last_x; x++)
+        {
+            SDL_Rect source;
+            TrailTile *tile = find(level, x, y);
+            if (tile == NULL) tile = stand_in(x, y, &source);
+            if (tile) tile->used = frame;
+        }
+    }
+    // At least one tile a frame, then more while the frame's time for them lasts
+    auto start = std::chrono::steady_clock::now();
+    bool missing = false, out_of_time = false;
+    for (int y = first_y; y <= last_y; y++)
+    {
+        for (int x = first_x; x <= last_x; x++)
+        {
+            if (find(level, x, y)) continue;
+            if (out_of_time)
+            {
+                missing = true;
+                continue;
+            }
+            rasterize(tree, level, x, y);
+            out_of_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000 > TRAIL_TILE_MILLISECONDS;
+        }
     }
-    else if (proj_scale >= 1)
+
+    // Upload whatever was drawn into the tiles
+    for (int i = 0; i < TRAIL_TILE_CACHE; i++)
     {
-        *orthproj = spirograph_base_node->direction_initial;
+        TrailTile *tile = &tiles[i];
+        if (!tile->ready || tile->framebuffer.dirty_top > tile->framebuffer.dirty_bottom) continue;
+        tile->framebuffer.upload(tile->texture);
+        changed = true;
     }
+    if (!changed) return false;
 
-    int mouseX = MouseState.pos.x, mouseY = MouseState.pos.y;
-    float closest_distance2 = pow(spirograph_base_node->position_initial.x + orthproj->x - mouseX, 2) + pow(spirograph_base_node->position_initial.y + orthproj->y - mouseY, 2);
-
-    // Find closest distance between parent and children
-    for (int i = 0; i < spirograph_base_node->children_length; i++)
+    // Missing tiles are covered by the part of the nearest coarser tile that is cached
+    SDL_SetRenderTarget(renderer, texture);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    for (int y = first_y; y <= last_y; y++)
     {
-        // Get closest grandchild
-        Spirograph *closest_grandchild;
-        float child_distance2;
-        Vec2Float child_orthproj;
-        node_near_cursor_orthproj(spirograph_base_node->children[i], &closest_grandchild, &child_distance2, &child_orthproj);
-
-        // Check if its the minimum distance
-        if (child_distance2 < closest_distance2)
+        for (int x = first_x; x <= last_x; x++)
         {
-            closest_distance2 = child_distance2;
-            *closest = closest_grandchild;
-            *orthproj = child_orthproj;
+            // Edges are rounded from the tile grid so neighbouring tiles neither overlap nor leave gaps
+            int left = roundf(view.offset.x + x * size), top = roundf(view.offset.y + y * size);
+            SDL_Rect destination = {left, top, (int)roundf(view.offset.x + (x + 1) * size) - left, (int)roundf(view.offset.y + (y + 1) * size) - top};
+            SDL_Rect source;
+            TrailTile *tile = find(level, x, y);
+            if (tile) SDL_RenderCopy(renderer, tile->texture, NULL, &destination);
+            else if ((tile = stand_in(x, y, &source))) SDL_RenderCopy(renderer, tile->texture, &source, &destination);
         }
     }
+    SDL_SetRenderTarget(renderer, NULL);
+    changed = missing; // Keep refining on the next frames
 
-    *distance2 = closest_distance2;
+    return true;
+}
+
+void TrailPyramid::free_members()
+{
+    for (int i = 0; i < TRAIL_TILE_CACHE; i++)
+    {
+        if (tiles[i].texture == NULL) continue;
+        SDL_DestroyTexture(tiles[i].texture);
+        tiles[i].framebuffer.free_members();
+        tiles[i].texture = NULL;
+        tiles[i].ready = false;
+    }
+    if (texture) SDL_DestroyTexture(texture);
+    texture = NULL;
 
     return;
 }
 
-void colour_palette(Spirograph *current_node, bool *hovering)
+// * TrailStore method definitions
+TrailStore::TrailStore()
 {
-    RGBA selected_colour = current_node->trail->colour;
-    
-    // Dimensions
-    int partitions = 3;
-    int margin = 20;
-    int spacing = margin * 0.25;
-    int button_radius = ((display.height - 2*margin) / (float)(partitions*partitions) - spacing*((partitions*partitions - 1) / (float)(partitions*partitions))) / 2.0f;
-    int draw_distance = 2*button_radius + spacing;
+    chunks = NULL;
+    chunks_length = chunks_capacity = 0;
+    points = bytes = 0;
+}
 
-    // Tell edit function if the user is hovering the colour palette interface
-    *hovering = MouseState.pos.x <= 2*margin + (partitions-1)*spacing + partitions*2*button_radius;
+void TrailStore::add(Vec2Float point, double time)
+{
+    Sint32 x = lroundf(point.x * (1 << TRAIL_STORE_FRACTION_BITS)), y = lroundf(point.y * (1 << TRAIL_STORE_FRACTION_BITS));
+    Sint64 t = llround(time / TRAIL_STORE_TIME_UNIT);
+    points++;
 
-    // Draw
-    for (int ri = 0; ri < partitions; ri++)
+    if (chunks_length == 0 || chunks[chunks_length - 1].length == TRAIL_STORE_CHUNK)
     {
-        int button_count = 0;
-        for (int gi = 0; gi < partitions; gi++)
+        if (bytes > TRAIL_STORE_MAX_BYTES && chunks_length > 1)
+        {   // Drop the oldest chunk, its byte array is kept for reuse after the last chunk
+            TrailChunk oldest = chunks[0];
+            points -= oldest.length;
+            bytes -= oldest.bytes_length;
+            memmove(chunks, chunks + 1, sizeof(TrailChunk) * (chunks_length - 1));
+            chunks[--chunks_length] = oldest;
+        }
+        if (chunks_length == chunks_capacity)
         {
-            for (int bi = 0; bi < partitions; bi++, button_count++)
+            chunks_capacity = chunks_capacity ? 2 * chunks_capacity : 16;
+            chunks = (TrailChunk*)realloc(chunks, sizeof(TrailChunk) * chunks_capacity);
+            if (chunks == NULL)
             {
-                // Button properties
-                RGBA button_colour = {ri * (255 / (float)(partitions - 1)), gi * (255 / (float)(partitions - 1)), bi * (255 / (float)(partitions - 1)), 255};
-                int x = margin + button_radius + (ri * draw_distance);   
-                int y = margin + button_radius + (button_count * draw_distance);   
+                printf("Failed to allocate memory to the trail history\n");
+                exit(1);
+            }
+            memset(chunks + chunks_length, 0, sizeof(TrailChunk) * (chunks_capacity - chunks_length));
+        }
 
-                // Detect click
-                bool hovering_button = pow(MouseState.pos.x - x, 2) + pow(MouseState.pos.y - y, 2) <= pow(button_radius, 2);
-                if (MouseState.left_down && hovering_button) selected_colour = button_colour;
+        // The first point is stored whole so the chunk can be decoded without the ones before it
+        TrailChunk *chunk = &chunks[chunks_length++];
+        chunk->bytes_length = 0;
+        chunk->length = 1;
+        chunk->first_x = chunk->tail_x[0] = chunk->tail_x[1] = x;
+        chunk->first_y = chunk->tail_y[0] = chunk->tail_y[1] = y;
+        chunk->first_time = chunk->tail_time[0] = chunk->tail_time[1] = t;
+        chunk->left = chunk->right = point.x;
+        chunk->top = chunk->bottom = point.y;
+        if (chunks_length > 1)
+        {   // The segment from the end of the chunk before is drawn with this one
+            Vec2Float before = tail(chunks_length - 2, 1);
+            chunk->tail_x[0] = chunks[chunks_length - 2].tail_x[1];
+            chunk->tail_y[0] = chunks[chunks_length - 2].tail_y[1];
+            chunk->left = fminf(chunk->left, before.x);
+            chunk->right = fmaxf(chunk->right, before.x);
+            chunk->top = fminf(chunk->top, before.y);
+            chunk->bottom = fmaxf(chunk->bottom, before.y);
+        }
+        return;
+    }
 
-                // Highlight button when already selected
-                if (button_colour.r == selected_colour.r && button_colour.g == selected_colour.g && button_colour.b == selected_colour.b && button_colour.a == selected_colour.a)
-                {
-                    SDL_SetRenderDrawColor(renderer, WHITE);
-                    SDL_RenderFillCircle(renderer, x, y, button_radius + 0.45*spacing); 
-                    SDL_SetRenderDrawColor(renderer, BLACK);
-                    SDL_RenderFillCircle(renderer, x, y, button_radius + 0.15*spacing); 
-                }
-                else if (hovering_button)
-                {
-                    SDL_SetRenderDrawColor(renderer, WHITE);
-                    SDL_RenderFillCircle(renderer, x, y, button_radius + 0.25*spacing); 
-                    SDL_SetRenderDrawColor(renderer, BLACK);
-                    SDL_RenderFillCircle(renderer, x, y, button_radius + 0.15*spacing); 
-                }
-                
-                // Draw button 
-                SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(button_colour));
-                SDL_RenderFillCircle(renderer, x, y, button_radius); 
-            }
+    TrailChunk *chunk = &chunks[chunks_length - 1];
+    if (chunk->bytes_length + 30 > chunk->bytes_capacity)
+    {   // Room for three varints of the longest length
+        chunk->bytes_capacity = chunk->bytes_capacity ? 2 * chunk->bytes_capacity : 1024;
+        chunk->bytes = (Uint8*)realloc(chunk->bytes, chunk->bytes_capacity);
+        if (chunk->bytes == NULL)
+        {
+            printf("Failed to allocate memory to the trail history\n");
+            exit(1);
         }
     }
 
-    current_node->trail->colour = selected_colour;
+    // Samples are evenly spaced in time along a smooth curve, so each step is close to the one before and the
+    // difference between them mostly fits in a byte. The first step of a chunk is stored as it is
+    long length_before = chunk->bytes_length;
+    auto put = [chunk](Sint64 value) -> void {
+        Uint64 zigzag = ((Uint64)value << 1) ^ (Uint64)(value >> 63);
+        while (zigzag >= 0x80)
+        {
+            chunk->bytes[chunk->bytes_length++] = (zigzag & 0x7f) | 0x80;
+            zigzag >>= 7;
+        }
+        chunk->bytes[chunk->bytes_length++] = zigzag;
+        return;
+    };
+    bool stepped = chunk->length > 1;
+    put((x - chunk->tail_x[1]) - (stepped ? chunk->tail_x[1] - chunk->tail_x[0] : 0));
+    put((y - chunk->tail_y[1]) - (stepped ? chunk->tail_y[1] - chunk->tail_y[0] : 0));
+    put((t - chunk->tail_time[1]) - (stepped ? chunk->tail_time[1] - chunk->tail_time[0] : 0));
+    bytes += chunk->bytes_length - length_before;
+
+    chunk->length++;
+    chunk->tail_x[0] = chunk->tail_x[1];
+    chunk->tail_y[0] = chunk->tail_y[1];
+    chunk->tail_x[1] = x;
+    chunk->tail_y[1] = y;
+    chunk->tail_time[0] = chunk->tail_time[1];
+    chunk->tail_time[1] = t;
+    chunk->left = fminf(chunk->left, point.x);
+    chunk->right = fmaxf(chunk->right, point.x);
+    chunk->top = fminf(chunk->top, point.y);
+    chunk->bottom = fmaxf(chunk->bottom, point.y);
 
     return;
 }
 
-void change_rotation_speed(Spirograph *selected_node, bool *editing, double dt)
+template <typename Visit>
+void TrailStore::decode(int chunk, Visit visit)
 {
-    // Define static slider struct
-    static struct
+    // visit(point, time) is called for every point of the chunk in order
+    TrailChunk *c = &chunks[chunk];
+    const Uint8 *in = c->bytes;
+    auto get = [&in]() -> Sint64 {
+        Uint64 zigzag = 0;
+        int shift = 0;
+        while (*in & 0x80)
+        {
+            zigzag |= (Uint64)(*in++ & 0x7f) << shift;
+            shift += 7;
+        }
+        zigzag |= (Uint64)(*in++) << shift;
+        return (Sint64)(zigzag >> 1) ^ -(Sint64)(zigzag & 1);
+    };
+
+    const float unit = 1.0f / (1 << TRAIL_STORE_FRACTION_BITS);
+    Sint32 x = c->first_x, y = c->first_y, step_x = 0, step_y = 0;
+    Sint64 t = c->first_time, step_t = 0;
+    visit({x * unit, y * unit}, t * TRAIL_STORE_TIME_UNIT);
+    for (int i = 1; i < c->length; i++)
     {
-        int margin = 30;
-        int x = display.width - margin;
-        int y;
-        int top = margin;
-        int bottom = display.height - margin;
-        int r = 5;
-        int hover_r = 7;
-        float min_value = 0;
-        float max_value = 2;
-        float value;
+        step_x += get();
+        step_y += get();
+        step_t += get();
+        x += step_x;
+        y += step_y;
+        t += step_t;
+        visit({x * unit, y * unit}, t * TRAIL_STORE_TIME_UNIT);
     }
-    slider;
-
-    // Update value and y position based on the revolutions per second set on the selected node
-    slider.value = selected_node->revps;
-    slider.y = ((slider.top - slider.bottom) / (float)(slider.max_value - slider.min_value)) * slider.value + slider.bottom;
 
-    // Detect slider and area hover
-    bool hovering_slider = pow(MouseState.pos.x - slider.x, 2) + pow(MouseState.pos.y - slider.y, 2) <= pow(slider.hover_r, 2);
-    bool hovering_area = MouseState.pos.x > display.width - 2*slider.margin;
-    static bool holding = false;
+    return;
+}
 
-    // Detect mouse clicks
-    if (MouseState.left_down && hovering_area) holding = true;
-    else if (!MouseState.left_down) holding = false;
-    if (MouseState.left_up) selected_node->reset();
+Vec2Float TrailStore::tail(int chunk, int i)
+{
+    // i = 1 is the chunk's last point, i = 0 the one before it
+    const float unit = 1.0f / (1 << TRAIL_STORE_FRACTION_BITS);
+    return {chunks[chunk].tail_x[i] * unit, chunks[chunk].tail_y[i] * unit};
+}
 
-    // Update the edit function if actions are being performed on the slider
-    *editing = hovering_slider || holding || hovering_area;
+void TrailStore::clear()
+{
+    // The chunks' byte arrays are kept to be filled again
+    chunks_length = 0;
+    points = bytes = 0;
 
-    // Draw slider
-    SDL_SetRenderDrawColor(renderer, WHITE);
-    SDL_RenderFillCircle(renderer, slider.x, slider.y, hovering_slider ? slider.hover_r : slider.r);
-    drawLine(renderer, {WHITE}, slider.x, slider.top, slider.x, slider.bottom);
+    return;
+}
 
-    // Control with the mouse if holding and update the rotation speed of the selected node based on the y position of the slider
-    if (holding)
+void TrailStore::free_members()
+{
+    for (int i = 0; i < chunks_capacity; i++)
     {
-        slider.y = MouseState.pos.y;
-        if (slider.y > slider.bottom) slider.y = slider.bottom;
-        if (slider.y < slider.top) slider.y = slider.top;
-
-        selected_node->rotate(dt);
-        
-        selected_node->revps = ((slider.max_value - slider.min_value) / (float)(slider.top - slider.bottom)) * (slider.y - slider.bottom);
-        selected_node->revps = ceil(selected_node->revps * 100) / 100.0f;
+        free(chunks[i].bytes);
     }
+    free(chunks);
+    chunks = NULL;
+    chunks_length = chunks_capacity = 0;
+    points = bytes = 0;
 
     return;
 }
 
-// * SpirographNode method definitions
-Spirograph::Spirograph(Vec2Float position_i, Vec2Float direction_i)
+// * PolylineSimplifier method definitions
+PolylineSimplifier::PolylineSimplifier()
 {
-    // Initial position and direction vectors
-    position_initial = position = position_i;
-    direction_initial = direction = direction_i;
+    create(0);
+}
 
-    head_radius = base_radius = default_radius;
-    revps = 0.3;
-    
-    children_length = 0;
-    children = (Spirograph**)malloc(0);
-    parent = NULL;
-    
-    is_root = false;
+void PolylineSimplifier::create(float tolerance0)
+{
+    tolerance = tolerance0;
+    end = {0, 0};
+    end_time = 0;
+    restart({0, 0});
+    started = false; // The first point is the anchor
+    points_in = points_out = 0;
 
-    // Trail
-    trail_on = false;
-    trail = new Trail({WHITE});
-    update_trail_first_point();
+    return;
 }
 
-void Spirograph::rotate(double dt)
+void PolylineSimplifier::restart(Vec2Float anchor0)
 {
-    // Cosine and sine of the angle adjusted by dt
-    float cos_a = cos((revps * 2 * PI) * dt);
-    float sin_a = sin((revps * 2 * PI) * dt);
+    // Continue from a point that was already drawn, like the end of the history chunk before
+    anchor = anchor0;
+    pending = false;
+    started = true;
+    aimed = false;
+    low = -PI;
+    high = PI;
+    reach = 0;
 
-    // Rotate direction vector
-    direction = {(direction.x * cos_a) - (direction.y * sin_a), (direction.x * sin_a) + (direction.y * cos_a)};
+    return;
+}
 
-    // Add points to trail
-    if (play) trail->new_point({position.x + direction.x, position.y + direction.y});
+template <typename Emit>
+void PolylineSimplifier::add(Vec2Float point, double time, Emit emit)
+{
+    // The segment from the anchor can be stretched to the new point if the point's direction is inside the sleeve
+    // and no point before it reaches farther out. Otherwise the segment so far is final and its end is the new anchor.
+    // A point d pixels out allows the directions within asin(tolerance / d) of its own, so only the sleeve is kept
+    points_in++;
+    if (!started || tolerance <= 0)
+    {
+        emit(point, time);
+        points_out++;
+        restart(point);
+        return;
+    }
 
-    // Adjust children's positions based on rotation
-    for (int i = 0; i < children_length; i++)
+    auto direction = [this](float dx, float dy) -> float {
+        return atan2f(reference.x * dy - reference.y * dx, reference.x * dx + reference.y * dy);
+    };
+    float dx = point.x - anchor.x, dy = point.y - anchor.y;
+    float distance = sqrtf(dx*dx + dy*dy);
+    bool straight = distance >= reach;
+    if (straight && aimed && distance > tolerance)
     {
-        children[i]->position.x = position.x + (direction.x * children[i]->position_on_parent);
-        children[i]->position.y = position.y + (direction.y * children[i]->position_on_parent);
+        float angle = direction(dx, dy);
+        straight = angle >= low && angle <= high;
+    }
+    if (pending && !straight)
+    {
+        emit(end, end_time);
+        points_out++;
+        restart(end);
+        dx = point.x - anchor.x;
+        dy = point.y - anchor.y;
+        distance = sqrtf(dx*dx + dy*dy);
     }
 
-    // Rotate children
-    for (int i = 0; i < children_length; i++)
+    // Points within the tolerance of the anchor are close to any segment from it
+    if (distance > tolerance)
     {
-        children[i]->rotate(dt);
+        if (!aimed)
+        {
+            reference = {dx / distance, dy / distance};
+            aimed = true;
+        }
+        float angle = direction(dx, dy), spread = asinf(tolerance / distance);
+        low = fmaxf(low, angle - spread);
+        high = fminf(high, angle + spread);
     }
+    reach = fmaxf(reach, distance);
+    end = point;
+    end_time = time;
+    pending = true;
 
     return;
 }
 
-void Spirograph::draw_trail()
+template <typename Emit>
+void PolylineSimplifier::finish(Emit emit)
 {
-    if (trail_on)
-        trail->draw();
-    for (int i = 0; i < children_length; i++)
-        children[i]->draw_trail();
+    // The last point is always kept, so whatever is drawn after it joins onto the exact end
+    if (pending)
+    {
+        emit(end, end_time);
+        points_out++;
+        restart(end);
+    }
+
     return;
 }
 
-void Spirograph::update_trail_first_point()
+// * Trail method definitions
+Trail::Trail(RGBA rgba)
 {
-    trail->first_point = {
-        position_initial.x + direction_initial.x,
-        position_initial.y + direction_initial.y
-    };
-    return;
+    colour = rgba;
+    first_point = current_point = previous_point = {0, 0};
+    new_points = NULL;
+    new_points_length = new_points_capacity = 0;
+    width = 1;
+    length = 0;
 }
 
-void Spirograph::draw(HighlightType highlight_type)
+void Trail::draw()
 {
-    for (int i = 0; i < children_length; i++) 
+    // Queue every segment added since the last frame on the trail batch, or rasterize it right away on the CPU
+    draw_new_points(cpuTrails.enabled ? &cpuTrails.framebuffer : NULL, 1, {0, 0});
+    if (new_points_length > 0)
     {
-        children[i]->draw(highlight_type);
+        previous_point = (new_points_length > 1) ? new_points[new_points_length - 2] : current_point;
+        current_point = new_points[new_points_length - 1];
     }
-    
-    draw_direction(highlight_type);
-    draw_head(highlight_type);
+    new_points_length = 0;
 
     return;
 }
 
-void Spirograph::draw_direction(HighlightType highlight_type)
-{
-    if (is_root) return;
-    drawLine(renderer, highlightColour[highlight_type], position.x, position.y, position.x + direction.x, position.y + direction.y);
-    return;
-}
-
-void Spirograph::draw_head(HighlightType highlight_type)
+void Trail::draw_new_points(Framebuffer *framebuffer, float scale, Vec2Float offset)
 {
-    RGBA colour = trail->colour;
-    colour.a = highlightAlpha[highlight_type];
-    
-    if (is_root) return;
-
-    if (trail_on)
-    {
-        SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(colour));
-        SDL_RenderFillCircle(renderer, position.x + direction.x, position.y + direction.y, head_radius);
-    }
-    else
+    // The segments added since the trail was last drawn, scaled and then offset, leaving them on the trail
+    Vec2Float previous = {offset.x + previous_point.x * scale, offset.y + previous_point.y * scale};
+    Vec2Float start = {offset.x + current_point.x * scale, offset.y + current_point.y * scale};
+    for (int i = 0; i < new_points_length; i++)
     {
-        SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(display.background_colour));
-        SDL_RenderFillCircle(renderer, position.x + direction.x, position.y + direction.y, head_radius);
-        
-        SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(colour));
-        SDL_RenderDrawCircle(renderer, position.x + direction.x, position.y + direction.y, head_radius);
+        Vec2Float end = {offset.x + new_points[i].x * scale, offset.y + new_points[i].y * scale};
+        int index = length - new_points_length + i;
+        if (index > 0)
+        {   // The very first point has nothing to connect to
+            draw_segment(framebuffer, colour, (index > 1) ? &previous : NULL, start, end, width * scale);
+        }
+        previous = start;
+        start = end;
     }
+
     return;
 }
 
-void Spirograph::draw_base(HighlightType highlight_type)
+void Trail::draw_segment(Framebuffer *framebuffer, RGBA rgba, const Vec2Float *previous, Vec2Float start, Vec2Float end, float stroke)
 {
-    if (is_root) return;
-
-    SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(display.background_colour));
-    SDL_RenderFillCircle(renderer, position.x, position.y, base_radius);
-    
-    SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(highlightColour[highlight_type]));
-    SDL_RenderDrawCircle(renderer, position.x, position.y, base_radius);
+    // Into the framebuffer, or onto the trail batch without one. Wide trails are stroked, joined round onto the segment before
+    if (stroke > 1)
+    {
+        if (framebuffer) framebuffer->draw_stroke(rgba, start.x, start.y, end.x, end.y, stroke, previous);
+        else trailBatch.add_stroke(rgba, start.x, start.y, end.x, end.y, stroke, previous);
+        return;
+    }
+    if (framebuffer) framebuffer->draw_line(rgba, start.x, start.y, end.x, end.y);
+    else trailBatch.add_line(rgba, start.x, start.y, end.x, end.y);
 
     return;
 }
 
-void Spirograph::reset()
+void Trail::redraw()
 {
-    // Set position back to initial position
-    position = position_initial;
-    direction = direction_initial;
-
-    // Reset trail
-    trail->reset();
-
-    // reset children
-    for (int i = 0; i < children_length; i++)
+    // Draw the whole history onto the trail target again, the points that were not drawn yet are part of it
+    PolylineSimplifier simplifier;
+    simplifier.create(simulation.tolerance);
+    rasterize(cpuTrails.enabled ? &cpuTrails.framebuffer : NULL, 1, {0, 0}, NULL, &simplifier);
+    if (history.chunks_length > 0)
     {
-        children[i]->reset();
+        previous_point = history.tail(history.chunks_length - 1, 0);
+        current_point = history.tail(history.chunks_length - 1, 1);
     }
+    new_points_length = 0;
 
     return;
 }
 
-void Spirograph::update_childrens_position_on_parent()
+void Trail::rasterize(Framebuffer *framebuffer, float scale, Vec2Float offset, const SDL_Rect *area, PolylineSimplifier *simplifier)
 {
-    // Update children's position on parent of this node
-    for (int i = 0; i < children_length; i++)
+    // One pass over the history, scaled and then offset. With an area only the chunks reaching into it are decoded,
+    // and only their segments reaching into it are drawn. Fading trails are drawn as faded as they are on the screen. The points are simplified in scaled pixels, each
+    // chunk on its own from the exact end of the one before, so tiles cut from the same level meet seamlessly
+    PolylineSimplifier every_point;
+    if (simplifier == NULL) simplifier = &every_point;
+    double now = simulation.samples * simulation.step;
+    float margin = width * scale / 2 + 2;
+    for (int c = 0; c < history.chunks_length; c++)
     {
-        children[i]->position_initial = children[i]->position = {
-            position.x + (direction.x * children[i]->position_on_parent),
-            position.y + (direction.y * children[i]->position_on_parent)
+        TrailChunk *chunk = &history.chunks[c];
+        if (area && (offset.x + chunk->right * scale + margin < area->x || offset.x + chunk->left * scale - margin >= area->x + area->w ||
+            offset.y + chunk->bottom * scale + margin < area->y || offset.y + chunk->top * scale - margin >= area->y + area->h)) continue;
+
+        // Continue from the end of the chunk before, so the segment between them is drawn and joined
+        Vec2Float previous = {0, 0}, start = {0, 0};
+        int known = 0;
+        if (c > 0)
+        {
+            previous = history.tail(c - 1, 0);
+            start = history.tail(c - 1, 1);
+            previous = {offset.x + previous.x * scale, offset.y + previous.y * scale};
+            start = {offset.x + start.x * scale, offset.y + start.y * scale};
+            known = 2;
+        }
+        auto draw = [&](Vec2Float end, double time) -> void {
+            // Segments missing the area are still followed, so the ones after them are joined to them
+            bool outside = area && (fmaxf(start.x, end.x) + margin < area->x || fminf(start.x, end.x) - margin >= area->x + area->w ||
+                fmaxf(start.y, end.y) + margin < area->y || fminf(start.y, end.y) - margin >= area->y + area->h);
+            if (known > 0 && !outside)
+            {
+                RGBA rgba = colour;
+                if (cpuTrails.half_life > 0)
+                {
+                    float fade = pow(0.5, (now - time) / cpuTrails.half_life);
+                    rgba = {colour.r * fade, colour.g * fade, colour.b * fade, colour.a};
+                }
+                draw_segment(framebuffer, rgba, (known > 1) ? &previous : NULL, start, end, width * scale);
+            }
+            previous = start;
+            start = end;
+            known++;
+            return;
         };
-        
-        // Update children's position on parent of each of this node's children's children
-        children[i]->update_childrens_position_on_parent();
+        if (c > 0) simplifier->restart(start);
+        else simplifier->started = false;
+        history.decode(c, [&](Vec2Float point, double time) -> void {
+            simplifier->add({offset.x + point.x * scale, offset.y + point.y * scale}, time, draw);
+            return;
+        });
+        simplifier->finish(draw);
     }
 
     return;
 }
 
-void Spirograph::add_child(Spirograph *new_child_ptr)
+void Trail::new_point(Vec2Float point0, double time)
 {
-    // Append to dynamically allocated array of child pointers
-    children_length++;
-
-    children = (Spirograph**)realloc(children, sizeof(Spirograph*) * children_length);
-    if (children == NULL)
+    length++;
+    if (new_points_length == new_points_capacity)
     {
-        printf("Failed to allocate memory to children array in Spiroraph\n");
-        exit(1);
+        new_points_capacity = new_points_capacity ? 2 * new_points_capacity : 64;
+        new_points = (Vec2Float*)realloc(new_points, sizeof(Vec2Float) * new_points_capacity);
+        if (new_points == NULL)
+        {
+            printf("Failed to allocate memory to trail points\n");
+            exit(1);
+        }
     }
-    children[children_length - 1] = new_child_ptr;
+    new_points[new_points_length++] = point0;
+    history.add(point0, time);
 
-    // Initialize child's parent pointer, position on parent, and rotation
-    new_child_ptr->parent = this;
-    Vec2Float child_end = {new_child_ptr->position_initial.x - position_initial.x, new_child_ptr->position_initial.y - position_initial.y};
-    new_child_ptr->position_on_parent = (direction_initial.x) ? child_end.x / direction_initial.x : child_end.y / direction_initial.y;
-    new_child_ptr->revps += revps;
+    return;
+}
+
+void Trail::reset()
+{
+    length = 0;
+    new_points_length = 0;
+    history.clear();
+    if (cpuTrails.enabled)
+    {
+        cpuTrails.framebuffer.clear({BLACK});
+        return;
+    }
+    SDL_SetRenderTarget(renderer, trail_texture);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    SDL_SetRenderTarget(renderer, NULL);
 
     return;
 }
 
-void Spirograph::remove_child(Spirograph *old_child_ptr)
+void Trail::free_members()
 {
-    if (children_length == 0) return;
+    free(new_points);
+    history.free_members();
+    new_points = NULL;
+    new_points_length = new_points_capacity = 0;
 
-    // Remove last child
-    if (children[children_length - 1] == old_child_ptr)
+    return;
+}
+
+void draw_trails(CompiledTree *tree)
+{
+    // New segments of every trail in one render target switch, then one copy to the screen
+    bool any_new = false;
+    for (int i = 0; i < tree->nodes_length && !any_new; i++)
     {
-        free(children[children_length - 1]);
-        children_length--;
-        return;
+        any_new = tree->trails[i] && tree->trails[i]->new_points_length > 0;
     }
 
-    // Remove first child
-    if (children[0] == old_child_ptr)
+    if (any_new)
     {
-        free(children[0]);
-        for (int i = 0; i < children_length - 1; i++)
+        for (int i = 0; i < tree->nodes_length; i++)
+        {
+            Trail *trail = tree->trails[i];
+            if (trail == NULL) continue;
+            if (damage.enabled && trail->new_points_length > 0)
+            {   // Only the area around the new segments changes
+                Vec2Float low = trail->current_point, high = trail->current_point;
+                for (int k = 0; k < trail->new_points_length; k++)
+                {
+                    low = {fminf(low.x, trail->new_points[k].x), fminf(low.y, trail->new_points[k].y)};
+                    high = {fmaxf(high.x, trail->new_points[k].x), fmaxf(high.y, trail->new_points[k].y)};
+                }
+                int pad = 1 + (int)ceil(trail->width / 2);
+                damage_restore({(int)floor(low.x) - pad, (int)floor(low.y) - pad, (int)(high.x - floor(low.x)) + 2 * pad + 2, (int)(high.y - floor(low.y)) + 2 * pad + 2});
+            }
+            trailPyramid.add_new_points(trail);
+            trail->draw();
+        }
+        if (!cpuTrails.enabled)
         {
-            children[i] = children[i + 1];
+            SDL_SetRenderTarget(renderer, trail_texture);
+            trailBatch.flush(renderer);
+            SDL_SetRenderTarget(renderer, NULL);
         }
+    }
 
-        children_length--;
-        children = (Spirograph**)realloc(children, sizeof(Spirograph*) * children_length);
+    // Rows cleared by a reset are dirty too, so upload even when nothing new was drawn
+    if (cpuTrails.enabled) cpuTrails.framebuffer.upload(cpuTrails.texture);
 
+    // The screen shows the trail target itself unless the view is zoomed or panned
+    SDL_Rect screen = {0, 0, display.width, display.height};
+    if (view_transformed())
+    {
+        bool changed = trailPyramid.compose(renderer, tree);
+        damage_layer(trailPyramid.texture, screen, changed);
         return;
     }
+    damage_layer(cpuTrails.enabled ? cpuTrails.texture : trail_texture, screen, false);
 
-    // Remove an inner child
-    for (int i = 0; i < children_length; i++)
-    {
-        if (children[i] == old_child_ptr)
-        {
-            for (int j = i; j < children_length - 1; j++)
-            {
-                children[j] = children[j + 1];
-            }
-
-            children_length--;
-            children = (Spirograph**)realloc(children, sizeof(Spirograph*) * children_length);
+    return;
+}
 
-            return;
-        }
+void redraw_trails(CompiledTree *tree)
+{
+    // Clear the trail target and draw every trail's history back into it, one batch flush for all of them
+    if (cpuTrails.enabled)
+    {
+        cpuTrails.framebuffer.clear({BLACK});
+    }
+    else
+    {
+        SDL_SetRenderTarget(renderer, trail_texture);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderClear(renderer);
     }
+    for (int i = 0; i < tree->nodes_length; i++)
+    {
+        if (tree->trails[i]) tree->trails[i]->redraw();
+    }
+    if (!cpuTrails.enabled)
+    {
+        trailBatch.flush(renderer);
+        SDL_SetRenderTarget(renderer, NULL);
+    }
+    trailPyramid.changed = true; // The composed view is a render target as well
+    damage.full = true;
 
     return;
 }
 
-void Spirograph::free_members()
+void print_trail_history(CompiledTree *tree)
 {
-    // Children
-    for (int i = 0; i < children_length; i++)
+    // Compressed size of the trail history, chunk headers included, against keeping a float point and a double timestamp
+    long long points = 0, bytes = 0;
+    for (int i = 0; i < tree->nodes_length; i++)
     {
-        children[i]->free_members();
+        if (tree->trails[i] == NULL) continue;
+        points += tree->trails[i]->history.points;
+        bytes += tree->trails[i]->history.bytes + tree->trails[i]->history.chunks_length * sizeof(TrailChunk);
     }
-    free(children);
+    if (points == 0) return;
+
+    long long raw = points * (sizeof(Vec2Float) + sizeof(double));
+    printf("Trail history: %lld points in %.1f KB instead of %.1f KB, %.1f:1\n", points, bytes / 1024.0, raw / 1024.0, raw / (double)bytes);
 
     return;
 }
 
-void Spirograph::clear_children()
+bool export_trails(CompiledTree *tree, const char *path, float scale)
 {
-    for (int i = 0; i < children_length; i++)
+    // Rasterize the trail history at a multiple of the screen size, independent of what is on the screen,
+    // simplified to within the tolerance in export pixels
+    Framebuffer framebuffer;
+    framebuffer.create(display.width * scale, display.height * scale);
+    framebuffer.clear({BLACK});
+    PolylineSimplifier simplifier;
+    simplifier.create(simulation.tolerance);
+    for (int i = 0; i < tree->nodes_length; i++)
     {
-        children[i]->clear_children();
-        remove_child(children[i]);
+        if (tree->trails[i]) tree->trails[i]->rasterize(&framebuffer, scale, {0, 0}, NULL, &simplifier);
     }
-    children_length = 0;
-    
-    return;
+    if (simplifier.points_in > 0 && simplifier.tolerance > 0)
+    {
+        printf("Simplified %lld trail points to %lld, %.1f%% fewer, within %g pixels\n", simplifier.points_in, simplifier.points_out,
+               100.0 * (simplifier.points_in - simplifier.points_out) / simplifier.points_in, simplifier.tolerance);
+    }
+    bool saved = framebuffer.save_bmp(path);
+    framebuffer.free_members();
+
+    return saved;
 }
 
-Vec2Float Spirograph::get_cursor_orthogonalProjection()
+// * View function definitions
+bool view_transformed()
 {
-    float proj_coeff =
-        (((MouseState.pos.x - position_initial.x)*direction_initial.x) +
-        ((MouseState.pos.y - position_initial.y)*direction_initial.y)) /
-        (pow(direction_initial.x, 2) + pow(direction_initial.y, 2));
-    Vec2Float orthogonal_projection = {proj_coeff * direction_initial.x, proj_coeff * direction_initial.y};
-    return orthogonal_projection;
+    return view.zoom != 1 || view.offset.x != 0 || view.offset.y != 0;
 }
 
-// * Trail method definitions
-Trail::Trail(RGBA rgba)
+Vec2Float view_to_screen(Vec2Float point)
 {
-    colour = rgba;
-    first_point = current_point = previous_point = {0, 0};
-    length = 0;
+    return {view.offset.x + point.x * view.zoom, view.offset.y + point.y * view.zoom};
 }
 
-void Trail::draw()
+void update_view()
 {
-    // Set target to trail texture and draw trail
-    if (length >= 2)
+    // Zoom about the cursor with the mouse wheel and pan by dragging with the left button
+    if (MouseState.scroll_up || MouseState.scroll_down)
     {
-        SDL_SetRenderTarget(renderer, trail_texture);
-        drawLine(renderer, colour, previous_point.x, previous_point.y, current_point.x, current_point.y);
-        SDL_SetRenderTarget(renderer, NULL);
-        SDL_RenderCopy(renderer, trail_texture, NULL, NULL);
+        float zoom = view.zoom * (MouseState.scroll_up ? VIEW_ZOOM_STEP : 1 / VIEW_ZOOM_STEP);
+        if (zoom < ldexpf(1, VIEW_MIN_LEVEL)) zoom = ldexpf(1, VIEW_MIN_LEVEL);
+        if (zoom > ldexpf(1, VIEW_MAX_LEVEL)) zoom = ldexpf(1, VIEW_MAX_LEVEL);
+        if (fabsf(zoom - 1) < 1e-3f) zoom = 1; // Steps back to 1 exactly so the unzoomed view is the trail target again
+
+        // The trail point under the cursor stays under it
+        view.offset = {MouseState.pos.x - (MouseState.pos.x - view.offset.x) * zoom / view.zoom,
+                       MouseState.pos.y - (MouseState.pos.y - view.offset.y) * zoom / view.zoom};
+        view.zoom = zoom;
+        trailPyramid.changed = true;
     }
+    if (MouseState.left_down && (MouseState.pos.x != view.last_mouse.x || MouseState.pos.y != view.last_mouse.y))
+    {
+        view.offset = {view.offset.x + MouseState.pos.x - view.last_mouse.x, view.offset.y + MouseState.pos.y - view.last_mouse.y};
+        trailPyramid.changed = true;
+    }
+    view.last_mouse = MouseState.pos;
 
     return;
 }
 
-void Trail::new_point(Vec2Float point0)
-{
-    length++;
-    previous_point = current_point;
-    current_point = point0;
-    return;
-}
-
-void Trail::reset()
+void reset_view()
 {
-    length = 0;
-    SDL_SetRenderTarget(renderer, trail_texture);
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
-    SDL_SetRenderTarget(renderer, NULL);
+    view.zoom = 1;
+    view.offset = {0, 0};
+    trailPyramid.changed = true;
 
     return;
 }
@@ -804,6 +4280,17 @@ float Vec2<T>::length()
     return sqrt(x*x + y*y);
 }
 
+float segment_distance(Vec2Float point, Vec2Float a, Vec2Float b)
+{
+    // From point to the closest point of the segment from a to b
+    float abx = b.x - a.x, aby = b.y - a.y;
+    float length2 = abx*abx + aby*aby;
+    float t = (length2 > 0) ? ((point.x - a.x) * abx + (point.y - a.y) * aby) / length2 : 0;
+    t = fminf(1, fmaxf(0, t));
+    float ex = point.x - a.x - t * abx, ey = point.y - a.y - t * aby;
+    return sqrtf(ex*ex + ey*ey);
+}
+
 // * Colour functions and operator overloads
 HSVA rgba_to_hsva(RGBA in)
 {
@@ -963,14 +4450,42 @@ void initialize_SDL()
 
     // Create renderer, window, and trail texture
     window = SDL_CreateWindow("Spirograph", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, display.width, display.height, SDL_WINDOW_FULLSCREEN_DESKTOP);
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_ACCELERATED);
+    if (!damage.enabled)
+    {
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_ACCELERATED);
+    }
+    if (renderer == NULL)
+    {   // No GPU, draw straight to the window surface so only the damaged rectangles have to be presented
+        renderer = SDL_CreateSoftwareRenderer(SDL_GetWindowSurface(window));
+        damage.enabled = true;
+    }
     trail_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, display.width, display.height);
+    circleSprites.create(renderer);
+    trailPyramid.create(renderer);
+
+    // The software renderer plots every anti-aliased point separately, drawing trails in memory is much faster
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(renderer, &info) == 0 && (info.flags & SDL_RENDERER_SOFTWARE))
+    {
+        cpuTrails.enabled = true;
+    }
+    if (cpuTrails.enabled)
+    {
+        cpuTrails.framebuffer.create(display.width, display.height);
+        cpuTrails.framebuffer.clear({BLACK});
+        cpuTrails.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, display.width, display.height);
+    }
 
     return;
 }
 
 void quit_SDL()
 {
+    if (cpuTrails.enabled)
+    {
+        SDL_DestroyTexture(cpuTrails.texture);
+        cpuTrails.framebuffer.free_members();
+    }
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -1010,6 +4525,15 @@ void handleEvents(bool *running, enum Mode *mode, Spirograph *root)
             //     }
             //     break;
             
+            // Window events
+            case SDL_WINDOWEVENT:
+                damage.full = true; // The window may have been covered or restored
+                if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) display.trails_lost = true;
+                break;
+            case SDL_RENDER_TARGETS_RESET:
+                display.trails_lost = true; // Render target textures lost their contents
+                break;
+
             // Mouse events
             case SDL_MOUSEBUTTONDOWN:
                 if (event.button.button == SDL_BUTTON_LEFT)
@@ -1048,11 +4572,154 @@ void handleEvents(bool *running, enum Mode *mode, Spirograph *root)
 
 void clearRenderer()
 {
+    // With damage tracking only the damaged rectangles are cleared, when the layers are composited
+    if (damage.enabled) return;
+
     SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(display.background_colour));
     SDL_RenderClear(renderer);
     return;
 }
 
+// * Damage tracking function definitions
+void damage_add(DamageList *list, SDL_Rect rect)
+{
+    SDL_Rect screen = {0, 0, display.width, display.height};
+    if (!SDL_IntersectRect(&rect, &screen, &rect)) return;
+
+    // Grow a rectangle this one overlaps instead of adding another
+    for (int i = 0; i < list->length; i++)
+    {
+        if (SDL_HasIntersection(&list->rects[i], &rect))
+        {
+            SDL_UnionRect(&list->rects[i], &rect, &list->rects[i]);
+            return;
+        }
+    }
+
+    if (list->length == DAMAGE_MAX_RECTS)
+    {   // Out of rectangles, fold them all into one
+        for (int i = 1; i < list->length; i++)
+        {
+            SDL_UnionRect(&list->rects[0], &list->rects[i], &list->rects[0]);
+        }
+        SDL_UnionRect(&list->rects[0], &rect, &list->rects[0]);
+        list->length = 1;
+        return;
+    }
+    list->rects[list->length++] = rect;
+
+    return;
+}
+
+void damage_restore(SDL_Rect rect)
+{
+    if (damage.enabled) damage_add(&damage.restore, rect);
+    return;
+}
+
+void damage_overlay(SDL_Rect rect)
+{
+    // Draws into textures are not on the screen
+    if (damage.enabled && SDL_GetRenderTarget(renderer) == NULL) damage_add(&damage.overlays, rect);
+    return;
+}
+
+void damage_layer(SDL_Texture *texture, SDL_Rect rect, bool changed)
+{
+    if (!damage.enabled)
+    {
+        SDL_RenderCopy(renderer, texture, NULL, &rect);
+        return;
+    }
+
+    // Composited once the frame's damage is known
+    if (changed) damage_add(&damage.restore, rect);
+    if (damage.layers_length < DAMAGE_MAX_LAYERS)
+    {
+        damage.layers[damage.layers_length++] = {texture, rect};
+    }
+
+    return;
+}
+
+void damage_composite()
+{
+    if (!damage.enabled || damage.composited) return;
+    damage.composited = true;
+
+    // Restore where the previous frame's overlays were, or everything
+    if (damage.full)
+    {
+        damage.restore.rects[0] = {0, 0, display.width, display.height};
+        damage.restore.length = 1;
+    }
+    for (int i = 0; i < damage.previous.length; i++)
+    {
+        damage_add(&damage.restore, damage.previous.rects[i]);
+    }
+
+    // Layers that appeared or went away since the previous frame
+    auto damage_missing = [](DamageLayer *layers, int layers_length, DamageLayer *others, int others_length) -> void {
+        for (int i = 0; i < layers_length; i++)
+        {
+            bool found = false;
+            for (int k = 0; k < others_length && !found; k++)
+            {
+                found = layers[i].texture == others[k].texture && SDL_RectEquals(&layers[i].rect, &others[k].rect);
+            }
+            if (!found) damage_add(&damage.restore, layers[i].rect);
+        }
+        return;
+    };
+    damage_missing(damage.layers, damage.layers_length, damage.previous_layers, damage.previous_layers_length);
+    damage_missing(damage.previous_layers, damage.previous_layers_length, damage.layers, damage.layers_length);
+
+    // Rebuild each rectangle from the background up, overlapping ones are simply rebuilt twice
+    SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(display.background_colour));
+    for (int i = 0; i < damage.restore.length; i++)
+    {
+        SDL_Rect *rect = &damage.restore.rects[i];
+        SDL_RenderFillRect(renderer, rect);
+        for (int l = 0; l < damage.layers_length; l++)
+        {
+            DamageLayer *layer = &damage.layers[l];
+            SDL_Rect destination;
+            if (!SDL_IntersectRect(rect, &layer->rect, &destination)) continue;
+            SDL_Rect source = {destination.x - layer->rect.x, destination.y - layer->rect.y, destination.w, destination.h};
+            SDL_RenderCopy(renderer, layer->texture, &source, &destination);
+        }
+    }
+
+    return;
+}
+
+void present()
+{
+    if (!damage.enabled)
+    {
+        SDL_RenderPresent(renderer);
+        return;
+    }
+
+    // Upload the restored rectangles and this frame's overlays
+    DamageList presented = damage.restore;
+    for (int i = 0; i < damage.overlays.length; i++)
+    {
+        damage_add(&presented, damage.overlays.rects[i]);
+    }
+    SDL_RenderFlush(renderer);
+    if (presented.length > 0) SDL_UpdateWindowSurfaceRects(window, presented.rects, presented.length);
+
+    damage.previous = damage.overlays;
+    memcpy(damage.previous_layers, damage.layers, sizeof(DamageLayer) * damage.layers_length);
+    damage.previous_layers_length = damage.layers_length;
+    damage.restore.length = damage.overlays.length = 0;
+    damage.layers_length = 0;
+    damage.full = damage.composited = false;
+
+    return;
+}
+
 // * Draw functions
 int SDL_RenderDrawCircle(SDL_Renderer * renderer, int x, int y, int radius)
 {
@@ -1145,26 +4812,47 @@ int SDL_RenderFillCircle(SDL_Renderer *renderer, int x, int y, int radius)
 
 void drawLine(SDL_Renderer *renderer, RGBA colour, int x0, int y0, int x1, int y1)
 {
-    // Xiaolin Wu's line algorithm
+    damage_overlay({x0 < x1 ? x0 - 1 : x1 - 1, y0 < y1 ? y0 - 1 : y1 - 1, abs(x1 - x0) + 3, abs(y1 - y0) + 3});
+    wu_line(x0, y0, x1, y1, NULL, [renderer, colour](int x, int y, float coverage) -> void {
+        SDL_SetRenderDrawColor(renderer, colour.r, colour.g, colour.b, 255 * coverage);
+        SDL_RenderDrawPoint(renderer, x, y);
+        return;
+    });
+
+    return;
+}
+
+template <typename Plot>
+void wu_line(float x0, float y0, float x1, float y1, const SDL_Rect *clip, Plot plot)
+{
+    wu_line(x0, y0, x1, y1, clip, plot, [&plot](int first, int from, int last, float intery, float gradient, bool steep) -> void {
+        wu_columns(first, from, last, intery, gradient, steep, plot);
+        return;
+    });
+
+    return;
+}
+
+template <typename Plot, typename Columns>
+void wu_line(float x0, float y0, float x1, float y1, const SDL_Rect *clip, Plot plot, Columns columns)
+{
+    // Xiaolin Wu's line algorithm, plot(x, y, coverage) is called for every touched pixel. The columns between
+    // the endpoints are handed to columns(first, from, last, intery, gradient, steep), so a caller can do several
+    // at once. With a clip rectangle only the columns [from, last) that can reach into it are handed on
     // Credit: https://en.wikipedia.org/wiki/Xiaolin_Wu%27s_line_algorithm
 
     // Helper lambda functions
-    auto fpart = [](float x) -> float {return x - (int)x;};
+    auto fpart = [](float x) -> float {return x - floor(x);};
     auto rfpart = [fpart](float x) -> float {return 1 - fpart(x);};
-    auto swap = [](int *a, int *b) -> void {
-        int temp = *a;
+    auto swap = [](float *a, float *b) -> void {
+        float temp = *a;
         *a = *b;
         *b = temp;
         return;
     };
-    auto plot = [](SDL_Renderer *renderer, int x, int y, RGBA colour) -> void{
-        SDL_SetRenderDrawColor(renderer, RGBA_EXPAND(colour));
-        SDL_RenderDrawPoint(renderer, x, y);
-        return;
-    };
-    
-    int steep = abs(y1 - y0) > abs(x1 - x0);
-    
+
+    bool steep = fabs(y1 - y0) > fabs(x1 - x0);
+
     if (steep) {
         swap(&x0, &y0);
         swap(&x1, &y1);
@@ -1173,57 +4861,199 @@ void drawLine(SDL_Renderer *renderer, RGBA colour, int x0, int y0, int x1, int y
         swap(&x0, &x1);
         swap(&y0, &y1);
     }
-    
-    int dx = x1 - x0;
-    int dy = y1 - y0;
-    float gradient = (dx == 0.0) ? 1.0 : dy / (float)dx;
 
-    int xend, yend;
-    float xgap;
-    
+    float dx = x1 - x0;
+    float dy = y1 - y0;
+    float gradient = (dx == 0.0) ? 1.0 : dy / dx;
+
+    float xend, yend, xgap;
+
     // handle first endpoint
     xend = round(x0);
     yend = y0 + gradient * (xend - x0);
     xgap = rfpart(x0 + 0.5);
     int xpxl1 = xend; // this will be used in the main loop
-    int ypxl1 = (int)yend;
+    int ypxl1 = floor(yend);
     if (steep) {
-        plot(renderer, ypxl1    , xpxl1, {colour.r, colour.g, colour.b, 255 * rfpart(yend) * xgap});
-        plot(renderer, ypxl1 + 1, xpxl1, {colour.r, colour.g, colour.b, 255 *  fpart(yend) * xgap});
+        plot(ypxl1    , xpxl1, rfpart(yend) * xgap);
+        plot(ypxl1 + 1, xpxl1,  fpart(yend) * xgap);
     } else {
-        plot(renderer, xpxl1, ypxl1    , {colour.r, colour.g, colour.b, 255 * rfpart(yend) * xgap});
-        plot(renderer, xpxl1, ypxl1 + 1, {colour.r, colour.g, colour.b, 255 *  fpart(yend) * xgap});
+        plot(xpxl1, ypxl1    , rfpart(yend) * xgap);
+        plot(xpxl1, ypxl1 + 1,  fpart(yend) * xgap);
     }
     float intery = yend + gradient; // first y-intersection for the main loop
-    
+
     // handle second endpoint
     xend = round(x1);
     yend = y1 + gradient * (xend - x1);
     xgap = fpart(x1 + 0.5);
     int xpxl2 = xend; //this will be used in the main loop
-    int ypxl2 = (int)yend;
+    int ypxl2 = floor(yend);
     if (steep) {
-        plot(renderer, ypxl2    , xpxl2, {colour.r, colour.g, colour.b, 255 * rfpart(yend) * xgap});
-        plot(renderer, ypxl2 + 1, xpxl2, {colour.r, colour.g, colour.b, 255 *  fpart(yend) * xgap});
+        plot(ypxl2    , xpxl2, rfpart(yend) * xgap);
+        plot(ypxl2 + 1, xpxl2,  fpart(yend) * xgap);
     } else {
-        plot(renderer, xpxl2, ypxl2    , {colour.r, colour.g, colour.b, 255 * rfpart(yend) * xgap});
-        plot(renderer, xpxl2, ypxl2 + 1, {colour.r, colour.g, colour.b, 255 *  fpart(yend) * xgap});
+        plot(xpxl2, ypxl2    , rfpart(yend) * xgap);
+        plot(xpxl2, ypxl2 + 1,  fpart(yend) * xgap);
     }
-    
+
     // main loop
-    if (steep) {
-        for (int x = xpxl1 + 1; x < xpxl2; x++) {
-			plot(renderer, (int)intery    , x, {colour.r, colour.g, colour.b, 255 * rfpart(intery)});
-			plot(renderer, (int)intery + 1, x, {colour.r, colour.g, colour.b, 255 *  fpart(intery)});
-			intery += gradient;
-		}
-    } else {
-        for (int x = xpxl1 + 1; x < xpxl2; x++) {
-			plot(renderer, x, (int)intery    , {colour.r, colour.g, colour.b, 255 * rfpart(intery)});
-			plot(renderer, x, (int)intery + 1, {colour.r, colour.g, colour.b, 255 *  fpart(intery)});
-			intery += gradient;
-		}
-	}
-
-	return;
+    int first = xpxl1 + 1, from = first, last = xpxl2;
+    if (clip)
+    {
+        // Columns across the clip rectangle, narrowed to where the line is within a row of it
+        int column_low = steep ? clip->y : clip->x, column_high = column_low + (steep ? clip->h : clip->w);
+        float row_low = (steep ? clip->x : clip->y) - 2, row_high = (steep ? clip->x + clip->w : clip->y + clip->h) + 1;
+        if (from < column_low) from = column_low;
+        if (last > column_high) last = column_high;
+        if (gradient != 0)
+        {
+            double a = first + (row_low - intery) / gradient, b = first + (row_high - intery) / gradient;
+            from = fmax(from, floor(fmin(a, b)) - 1);
+            last = fmin(last, ceil(fmax(a, b)) + 1);
+        }
+        else if (intery < row_low || intery > row_high) last = from;
+    }
+    if (from < last) columns(first, from, last, intery, gradient, steep);
+
+    return;
+}
+
+template <typename Plot>
+void wu_columns(int first, int from, int last, float intery, float gradient, bool steep, Plot plot)
+{
+    // The main loop of wu_line over the columns [from, last) of those starting at first, intery is where the line
+    // crosses the first one. Every column's crossing is computed from there rather than summed up, so callers doing
+    // several columns at once get the same coverage bit for bit
+    auto fpart = [](float x) -> float {return x - floor(x);};
+    auto rfpart = [fpart](float x) -> float {return 1 - fpart(x);};
+
+    for (int x = from; x < last; x++) {
+        float y = intery + (float)(x - first) * gradient;
+        if (steep) {
+            plot((int)floor(y)    , x, rfpart(y));
+            plot((int)floor(y) + 1, x,  fpart(y));
+        } else {
+            plot(x, (int)floor(y)    , rfpart(y));
+            plot(x, (int)floor(y) + 1,  fpart(y));
+        }
+    }
+
+    return;
+}
+
+template <typename Plot, typename Span>
+void stroke_segment(float x0, float y0, float x1, float y1, float width, const Vec2Float *previous, const SDL_Rect *clip, Plot plot, Span span)
+{
+    // Round capped stroke of the given width: the capsule around the segment, with coverage falling off linearly
+    // over one pixel across its edge. Pixels fully inside are handed to span(y, first, last) a row at a time,
+    // edge pixels to plot(x, y, coverage). With the previous point given, the stroke is joined to the segment
+    // from there: pixels get the larger of the two coverages instead of being blended twice. With a clip rectangle
+    // only the pixels inside it are handed on
+    float r = width / 2;
+    float dx = x1 - x0, dy = y1 - y0;
+    float length = sqrtf(dx*dx + dy*dy);
+    float ux = (length > 0) ? dx / length : 0, uy = (length > 0) ? dy / length : 0;
+
+    // Helper lambda functions
+    auto distance = [](float px, float py, float ax, float ay, float bx, float by) -> float {
+        float abx = bx - ax, aby = by - ay;
+        float length2 = abx*abx + aby*aby;
+        float t = (length2 > 0) ? ((px - ax) * abx + (py - ay) * aby) / length2 : 0;
+        t = fminf(1, fmaxf(0, t));
+        float ex = px - ax - t * abx, ey = py - ay - t * aby;
+        return sqrtf(ex*ex + ey*ey);
+    };
+    auto coverage = [r](float d) -> float {return fminf(1, fmaxf(0, r + 0.5f - d));};
+
+    // Part of row yc within radius of the segment, the union of the end discs and the rectangle between them
+    auto row_span = [&](float yc, float radius, float *left, float *right) -> bool {
+        float lo = INFINITY, hi = -INFINITY;
+        float ends[2][2] = {{x0, y0}, {x1, y1}};
+        for (int e = 0; e < 2; e++)
+        {
+            float h = radius * radius - (yc - ends[e][1]) * (yc - ends[e][1]);
+            if (h < 0) continue;
+            lo = fminf(lo, ends[e][0] - sqrtf(h));
+            hi = fmaxf(hi, ends[e][0] + sqrtf(h));
+        }
+
+        if (length > 0)
+        {   // Along the segment within [0, length] and across it within [-radius, radius], both linear in x
+            float rect_lo = -INFINITY, rect_hi = INFINITY;
+            auto clip = [&rect_lo, &rect_hi](float slope, float offset, float min, float max) -> void {
+                if (fabsf(slope) < 1e-6f)
+                {
+                    if (offset < min || offset > max) rect_lo = INFINITY;
+                    return;
+                }
+                float a = (min - offset) / slope, b = (max - offset) / slope;
+                rect_lo = fmaxf(rect_lo, fminf(a, b));
+                rect_hi = fminf(rect_hi, fmaxf(a, b));
+                return;
+            };
+            clip(ux, -x0 * ux + (yc - y0) * uy, 0, length);
+            clip(-uy, x0 * uy + (yc - y0) * ux, -radius, radius);
+            if (rect_lo <= rect_hi)
+            {
+                lo = fminf(lo, rect_lo);
+                hi = fmaxf(hi, rect_hi);
+            }
+        }
+
+        *left = lo;
+        *right = hi;
+        return lo <= hi;
+    };
+
+    auto edge_pixel = [&](int x, int y) -> void {
+        float xc = x + 0.5f, yc = y + 0.5f;
+        float a = coverage(distance(xc, yc, x0, y0, x1, y1));
+        if (previous)
+        {   // Only add what the previous segment did not already cover
+            float p = coverage(distance(xc, yc, previous->x, previous->y, x0, y0));
+            if (p >= a) return;
+            a = (a - p) / (1 - p);
+        }
+        if (a > 0) plot(x, y, a);
+        return;
+    };
+
+    float top = floorf(fminf(y0, y1) - r - 0.5f), bottom = ceilf(fmaxf(y0, y1) + r + 0.5f);
+    float left = -INFINITY, right = INFINITY;
+    if (clip)
+    {
+        top = fmaxf(top, clip->y);
+        bottom = fminf(bottom, clip->y + clip->h - 1);
+        left = clip->x;
+        right = clip->x + clip->w - 1;
+    }
+    for (int y = top; y <= bottom; y++)
+    {
+        float yc = y + 0.5f;
+        float outer_left, outer_right, inner_left, inner_right;
+        if (!row_span(yc, r + 0.5f, &outer_left, &outer_right)) continue;
+        int first = fmaxf(left, ceilf(outer_left - 0.5f)), last = fminf(right, floorf(outer_right - 0.5f));
+        if (first > last) continue;
+
+        // Pixel centres at least half a pixel inside the edge are fully covered
+        int span_first = last + 1, span_last = last;
+        if (r > 0.5f && row_span(yc, r - 0.5f, &inner_left, &inner_right))
+        {
+            span_first = fmaxf(first, ceilf(inner_left - 0.5f));
+            span_last = fminf(last, floorf(inner_right - 0.5f));
+        }
+
+        for (int x = first; x < span_first && x <= last; x++)
+        {
+            edge_pixel(x, y);
+        }
+        if (span_first <= span_last) span(y, span_first, span_last);
+        for (int x = span_last + 1; x <= last; x++)
+        {
+            edge_pixel(x, y);
+        }
+    }
+
+    return;
 }
@@ -7,8 +7,14 @@
 #include <string.h>
 #include <time.h>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
 #include <math.h>
 #include <SDL.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 // * MACRODEFINITIONS
 // Constants
@@ -25,10 +31,95 @@
 #define ORANGE 255, 100, 0, 255
 #define PURPLE 255, 0, 255, 255
 
+// SIMD, the widest instruction set the compiler was allowed to use
+#if defined(__AVX512F__)
+#define SIMD_WIDTH 16
+typedef __m512 simd_float;
+#define simd_set1 _mm512_set1_ps
+#define simd_load _mm512_load_ps
+#define simd_store _mm512_store_ps
+#define simd_loadu _mm512_loadu_ps
+#define simd_storeu _mm512_storeu_ps
+#define simd_add _mm512_add_ps
+#define simd_sub _mm512_sub_ps
+#define simd_mul _mm512_mul_ps
+#elif defined(__AVX__)
+#define SIMD_WIDTH 8
+typedef __m256 simd_float;
+#define simd_set1 _mm256_set1_ps
+#define simd_load _mm256_load_ps
+#define simd_store _mm256_store_ps
+#define simd_loadu _mm256_loadu_ps
+#define simd_storeu _mm256_storeu_ps
+#define simd_add _mm256_add_ps
+#define simd_sub _mm256_sub_ps
+#define simd_mul _mm256_mul_ps
+#elif defined(__SSE2__)
+#define SIMD_WIDTH 4
+typedef __m128 simd_float;
+#define simd_set1 _mm_set1_ps
+#define simd_load _mm_load_ps
+#define simd_store _mm_store_ps
+#define simd_loadu _mm_loadu_ps
+#define simd_storeu _mm_storeu_ps
+#define simd_add _mm_add_ps
+#define simd_sub _mm_sub_ps
+#define simd_mul _mm_mul_ps
+#else
+#define SIMD_WIDTH 1
+typedef float simd_float;
+#define simd_set1(a) (a)
+#define simd_load(p) (*(p))
+#define simd_store(p, a) (*(p) = (a))
+#define simd_loadu(p) (*(p))
+#define simd_storeu(p, a) (*(p) = (a))
+#define simd_add(a, b) ((a) + (b))
+#define simd_sub(a, b) ((a) - (b))
+#define simd_mul(a, b) ((a) * (b))
+#endif
+#define PHASOR_BLOCK 256 // Samples evaluated between exact re-seeds of the rotation recurrences
+
 // Default settings
 #define DEFAULT_LENGTH 100
 #define DEFAULT_ANGLE 0
 #define DEFAULT_REVPS 1
+#define DEFAULT_MAX_SEGMENT_LENGTH 2 // Pixels
+#define DEFAULT_TOLERANCE 0.1f       // Pixels
+#define ADAPTIVE_BASE_LENGTH 8       // Pixels a trail moves at most in one step before adaptive sampling refines it
+#define ADAPTIVE_MAX_DEPTH 12        // Times a step may be halved
+#define ADAPTIVE_MAX_MERGE 64        // Segments merged into one at most on straight stretches
+#define MAX_SUBSTEPS 4096            // Simulation steps per frame before the backlog is dropped
+#define SWEEP_DURATION 60            // Seconds rendered for variants that never close
+#define SWEEP_MAX_SAMPLES (1 << 22)  // Samples per trail and variant
+#define PREVIEW_MAX_SEGMENT_LENGTH 4 // Pixels
+#define PREVIEW_MAX_SAMPLES (1 << 16)
+#define PREVIEW_COARSE_SAMPLES 256      // Segments of the first preview level
+#define PREVIEW_POINTS_PER_FRAME 8192   // Preview points drawn per frame, keeps the frame time bounded
+#define PREVIEW_ALPHA 90
+#define LINE_BATCH_LEVELS 32 // Coverage levels anti-aliased points are bucketed into
+#define SPRITE_MAX_RADIUS 16 // Largest circle in the sprite atlas, bigger ones are drawn directly
+#define DAMAGE_MAX_RECTS 64  // Damaged rectangles tracked per frame before they are merged
+#define DAMAGE_MAX_LAYERS 4
+#define POSTER_TILE_SIZE 256 // Pixels, poster exports are rasterized one row of tiles at a time
+#define POSTER_CHUNK 4096    // Segments evaluated together when gathering the segments of a tile row
+#define STROKE_MAX_WIDTH 32    // Pixels, trails are hairlines at width 1
+#define STROKE_WIDTH_STEP 0.5f
+#define BENCH_SEGMENTS 200000 // Trail segments rasterized per benchmark run
+#define TRAIL_STORE_CHUNK 4096          // Points per independently decodable chunk of a trail's history
+#define TRAIL_STORE_FRACTION_BITS 8      // Trail points are stored in fixed point, 1/256 of a pixel
+#define TRAIL_STORE_TIME_UNIT 1e-6       // Seconds, trail timestamps are stored in microseconds
+#define TRAIL_STORE_MAX_BYTES (64L << 20) // Compressed history kept per trail before the oldest chunks are dropped
+#define TRAIL_EXPORT_SCALE 2         // Trail images are saved at this multiple of the screen size
+#define TRAIL_TILE_SIZE 256      // Pixels per side of a trail pyramid tile
+#define TRAIL_TILE_CACHE 256     // Tiles kept rasterized, the least recently drawn is replaced
+#define TRAIL_TILE_MILLISECONDS 8 // Time per frame spent rasterizing tiles, the rest of the view shows coarser tiles meanwhile
+#define VIEW_ZOOM_STEP 1.25f     // Zoom per mouse wheel notch
+#define VIEW_MIN_LEVEL -3        // Coarsest pyramid level, 1/8 tile pixel per trail pixel
+#define VIEW_MAX_LEVEL 8         // Finest pyramid level, 256 tile pixels per trail pixel
+#define DECAY_TILE 64         // Pixels, fading skips tiles with nothing lit
+#define DENSITY_GAMMA 2.2
+#define DENSITY_HISTOGRAM_BINS 4096
+#define DENSITY_MAX_MEMORY ((size_t)1 << 30) // Bytes of per-thread density buffers
 
 // * TYPE DEFINITIONS
 template <typename T>
@@ -53,21 +144,116 @@ typedef struct
 
 bool play = true;
 enum Mode {EDIT, ANIMATE};
+enum SweepParameter {SWEEP_REVPS, SWEEP_LENGTH, SWEEP_POSITION_ON_PARENT};
+enum ToneMap {TONE_MAP_NONE, TONE_MAP_LOG, TONE_MAP_GAMMA, TONE_MAP_EQUALIZE};
+
+typedef struct
+{
+    int node; // Index in the breadth-first order of the scene file
+    enum SweepParameter parameter;
+    float from, to;
+    int steps;
+} SweepAxis;
+
+typedef struct
+{
+    SDL_Rect rects[DAMAGE_MAX_RECTS];
+    int length;
+} DamageList;
+
+typedef struct
+{
+    float x0, y0, x1, y1; // Image pixels
+    Vec2Float previous;   // Start of the segment before, for the join
+    bool joined;          // Whether there is a segment before
+    int node;
+} PosterSegment;
+
+typedef struct
+{
+    SDL_Texture *texture;
+    SDL_Rect rect; // Where the texture goes on the screen
+} DamageLayer;
+
+typedef struct
+{
+    Uint8 *bytes;     // For every point after the first, zigzag varints of how much the steps in x, y and time changed
+    long bytes_length, bytes_capacity;
+    int length;       // Points in the chunk
+    Sint32 first_x, first_y;     // Fixed point
+    Sint64 first_time;           // TRAIL_STORE_TIME_UNITs
+    Sint32 tail_x[2], tail_y[2]; // Last two points, so the chunk after can join onto them without decoding this one
+    Sint64 tail_time[2];
+    float left, top, right, bottom; // Pixel bounds, including the segment from the chunk before
+} TrailChunk;
 
 // * CLASS PROTOTYPES
+class Framebuffer;
+
+// Trail history delta coded into chunks, each of which can be decoded on its own
+class TrailStore
+{
+    public:
+        TrailChunk *chunks;
+        int chunks_length, chunks_capacity;
+        long points;      // Points in all chunks
+        long bytes;       // Compressed bytes in all chunks
+
+        TrailStore();
+        void add(Vec2Float point, double time);
+        template <typename Visit> void decode(int chunk, Visit visit);
+        Vec2Float tail(int chunk, int i);
+        void clear();
+        void free_members();
+};
+
+// Drops trail points as they stream past, in constant time each, while every dropped point stays within the
+// tolerance of the segment drawn in their place
+class PolylineSimplifier
+{
+    public:
+        float tolerance;  // Pixels, 0 keeps every point
+        Vec2Float anchor; // Last point kept
+        Vec2Float end;    // Last point seen, where the segment from the anchor ends so far
+        double end_time;
+        bool pending;     // Points were seen since the anchor
+        bool started;     // There is an anchor
+        Vec2Float reference; // Unit direction from the anchor the sleeve angles are measured from
+        bool aimed;          // The reference is set, no point beyond the tolerance was seen until then
+        float low, high;     // Radians, directions from the anchor passing within the tolerance of every point since
+        float reach;         // Distance from the anchor of the farthest point since
+        long long points_in, points_out;
+
+        PolylineSimplifier();
+        void create(float tolerance0);
+        void restart(Vec2Float anchor0);
+        template <typename Emit> void add(Vec2Float point, double time, Emit emit);
+        template <typename Emit> void finish(Emit emit);
+};
+
 class Trail
 {
     public:
         Vec2Float first_point;
         Vec2Float current_point;
         Vec2Float previous_point;
+        Vec2Float *new_points; // Points added since the trail was last drawn
+        int new_points_length, new_points_capacity;
         RGBA colour;
+        float width; // Pixels
         int length;
 
+        TrailStore history; // Every point of the trail so far, so it can be redrawn without simulating it again
+
         Trail(RGBA rgba);
         void draw();
-        void new_point(Vec2Float point0);
+        void draw_segment(Framebuffer *framebuffer, RGBA rgba, const Vec2Float *previous, Vec2Float start, Vec2Float end, float stroke);
+        void redraw();
+        void rasterize(Framebuffer *framebuffer, float scale, Vec2Float offset, const SDL_Rect *area, PolylineSimplifier *simplifier);
+        void draw_new_points(Framebuffer *framebuffer, float scale, Vec2Float offset);
+        void new_point(Vec2Float point0, double time);
         void reset();
+        void free_members();
 };
 
 class Spirograph
@@ -81,6 +267,7 @@ class Spirograph
         bool is_root;
         const SDL_Scancode delete_node_key = SDL_SCANCODE_BACKSPACE;
         const SDL_Scancode reset_key = SDL_SCANCODE_R;
+        const SDL_Scancode save_key = SDL_SCANCODE_S;
 
         // Parent members
         Spirograph *parent;
@@ -93,6 +280,8 @@ class Spirograph
         bool trail_on;
         Trail *trail;
         const SDL_Scancode toggle_trail_key = SDL_SCANCODE_Q;
+        const SDL_Scancode thinner_trail_key = SDL_SCANCODE_LEFTBRACKET;
+        const SDL_Scancode thicker_trail_key = SDL_SCANCODE_RIGHTBRACKET;
 
         // Head and base
         int head_radius, base_radius;
@@ -113,7 +302,6 @@ class Spirograph
         void reset();
         void update_childrens_position_on_parent();
 
-        void draw_trail();
         void update_trail_first_point();
         void draw(enum HighlightType);
         void draw_direction(enum HighlightType);
@@ -128,18 +316,296 @@ class Spirograph
         Vec2Float get_cursor_orthogonalProjection();
 };
 
+// Breadth-first, structure-of-arrays copy of the spirograph tree used by the animation step
+class CompiledTree
+{
+    public:
+        int nodes_length, nodes_capacity;
+        int canvas_width, canvas_height; // Size of the display the scene was made on
+        Spirograph **nodes; // Editor node each entry was compiled from, NULL when loaded from a file
+        Trail **trails;     // Trail of each entry, NULL when the node's trail is off or there is no editor node
+        bool *trail_on;
+        RGBA *trail_colour;
+        float *trail_width;
+
+        // Parents always come before their children, so one forward pass visits the tree top-down
+        int *parent;        // Index of the parent entry, -1 for the base node
+        float *position_x, *position_y;
+        float *direction_x, *direction_y;
+        float *direction_initial_x, *direction_initial_y;
+        float *position_on_parent;
+        float *revps;
+        double time;        // Seconds of animation the current state corresponds to
+
+        CompiledTree();
+        void reserve(int count);
+        void compile(Spirograph *root);
+        void copy(CompiledTree *other);
+        bool save(const char *path);
+        bool load(const char *path);
+        void seek(double t);
+        void apply();
+        void free_members();
+};
+
+typedef struct
+{
+    float amplitude_x, amplitude_y;
+    double revps;
+} Phasor;
+
+// Closed-form tip positions: each node's tip is a constant origin plus a sum of rotating phasors
+class PhasorEvaluator
+{
+    public:
+        int nodes_length;
+        Vec2Float *origin;
+        int *phasors_start, *phasors_length; // Range of each node's phasors in the phasors array
+        Phasor *phasors;
+        int phasors_total, phasors_capacity;
+
+        PhasorEvaluator();
+        void compile(CompiledTree *tree);
+        Vec2Float tip(int node, double t);
+        float max_speed(int node);
+        double closure_period(CompiledTree *tree);
+        void tips(int node, double t0, double dt, long long first, int count, Vec2Float *out);
+        void tips_reference(int node, double t0, double dt, long long first, int count, Vec2Float *out);
+        void free_members();
+};
+
+// RGBA32 image in memory, drawn to without a renderer
+class Framebuffer
+{
+    public:
+        int width, height;
+        Uint8 *pixels; // 4 bytes per pixel in R, G, B, A order
+        int dirty_top, dirty_bottom; // Rows changed since the last upload, none when top > bottom
+        Uint8 *lit;                  // Per DECAY_TILE square, whether anything in it may not be black
+        int tiles_x, tiles_y;
+
+        Framebuffer();
+        void create(int w, int h);
+        void clear(RGBA colour);
+        void mark_dirty(int top, int bottom);
+        void mark_lit(int left, int top, int right, int bottom);
+        SDL_Rect decay(float factor);
+        void blend(int x, int y, RGBA colour, float coverage);
+        void fill_span(int y, int x0, int x1, RGBA colour);
+        void draw_line(RGBA colour, float x0, float y0, float x1, float y1);
+        void draw_stroke(RGBA colour, float x0, float y0, float x1, float y1, float width, const Vec2Float *previous);
+        void upload(SDL_Texture *texture);
+        bool save_bmp(const char *path);
+        void free_members();
+};
+
+// Trail coverage summed per pixel instead of blended, so thousands of overlapping passes don't saturate.
+// Tone mapping turns it into an image
+class DensityBuffer
+{
+    public:
+        int width, height;
+        float *cells; // Colour weighted by coverage in R, G, B and the total coverage, per pixel
+
+        // Strokes only: per pixel, how far along the strokes the last one covering it ended and how much of the
+        // pixel its pass already counted. Allocated by the first stroke
+        double *reached;
+        float *counted;
+        double along; // Length of the strokes drawn so far, with a gap wherever a trail breaks off
+
+        DensityBuffer();
+        void create(int w, int h);
+        void clear();
+        void accumulate(int x, int y, RGBA colour, float coverage);
+        void draw_line(RGBA colour, float x0, float y0, float x1, float y1);
+        void draw_stroke(RGBA colour, float x0, float y0, float x1, float y1, float width, const Vec2Float *previous, bool count);
+        void add(DensityBuffer *other);
+        void tone_map(enum ToneMap mode, Framebuffer *out);
+        void free_members();
+};
+
+typedef struct
+{
+    Vec2Float *points; // One curve of samples points per trailed node
+    long samples;
+    int curves;
+    RGBA *colours;          // Of each curve, so a level can be drawn after the job that made it was replaced
+    unsigned long revision; // Scene revision the level was computed for
+} PreviewLevel;
+
+// Full closed curve of the scene being edited, computed on a worker thread from a coarse
+// sampling that doubles in density until the scene changes again
+class Preview
+{
+    public:
+        CompiledTree tree;          // Snapshot of the scene the worker reads
+        PhasorEvaluator evaluator;
+        unsigned long revision;     // Scene revision of the snapshot
+        std::thread worker;
+        std::atomic<bool> cancel;
+        int curves_length;
+        int *curve_nodes;
+
+        // Newest finished level, handed from the worker to the main thread
+        std::mutex pending_mutex;
+        PreviewLevel pending;
+
+        // Level being drawn into the back texture a few points per frame while the front one is shown
+        PreviewLevel drawing;
+        int drawing_curve;
+        long drawing_point;
+        SDL_Texture *textures[2];
+        int front;
+
+        Preview();
+        void update(Spirograph *root);
+        void compute();
+        void publish(PreviewLevel level);
+        void free_level(PreviewLevel *level);
+        void stop();
+        void draw();
+        void free_members();
+};
+
+typedef struct
+{
+    RGBA colour;
+    SDL_FPoint *points[LINE_BATCH_LEVELS]; // Pixels of each coverage level
+    int points_length[LINE_BATCH_LEVELS], points_capacity[LINE_BATCH_LEVELS];
+    SDL_FRect *spans; // Fully covered runs of stroke pixels, one pixel high
+    int spans_length, spans_capacity;
+} LineBatchBucket;
+
+// Anti-aliased lines collected as points bucketed by colour and coverage, submitted with one draw call per bucket.
+// The fully covered inside of wide strokes is collected as rectangles, one more draw call per colour
+class LineBatch
+{
+    public:
+        LineBatchBucket *buckets;
+        int buckets_length, buckets_capacity;
+        long long points, draw_calls; // Totals since the program started, for comparing against two calls per point
+
+        LineBatch();
+        LineBatchBucket *find_bucket(RGBA colour);
+        void add_point(LineBatchBucket *bucket, int x, int y, float coverage);
+        void add_span(LineBatchBucket *bucket, int y, int first, int last);
+        void add_line(RGBA colour, float x0, float y0, float x1, float y1);
+        void add_stroke(RGBA colour, float x0, float y0, float x1, float y1, float width, const Vec2Float *previous);
+        void flush(SDL_Renderer *renderer);
+        void free_members();
+};
+
+// Filled and outlined white circles of every radius rasterized once into an atlas texture, tinted per vertex
+// so every head and base queued during a frame is drawn with a single geometry call
+class CircleSprites
+{
+    public:
+        SDL_Texture *atlas;
+        SDL_Rect sprites[2][SPRITE_MAX_RADIUS + 1]; // Outline and filled sprite of each radius
+        int atlas_width, atlas_height;
+        SDL_Vertex *vertices;
+        int *indices;
+        int quads_length, quads_capacity;
+
+        CircleSprites();
+        void create(SDL_Renderer *renderer);
+        void add(RGBA colour, int x, int y, int radius, bool filled);
+        void flush(SDL_Renderer *renderer);
+        void free_members();
+};
+
+typedef struct
+{
+    int level, x, y;     // Tile x, y of a pyramid level, which has 2^level tile pixels per trail pixel
+    bool ready;          // Rasterized, the framebuffer's dirty rows still have to be uploaded
+    unsigned long used;  // Frame the tile was last drawn in
+    Framebuffer framebuffer;
+    SDL_Texture *texture;
+} TrailTile;
+
+// Trails rasterized from their history into tiles at power of two scales. A zoomed or panned view is composed
+// from the cached tiles, tiles it has not seen yet are rasterized for a few milliseconds a frame and shown from a coarser
+// level until then. New segments are drawn straight into the cached tiles they touch
+class TrailPyramid
+{
+    public:
+        TrailTile tiles[TRAIL_TILE_CACHE];
+        SDL_Texture *texture; // The view composed from the tiles, at the size of the screen
+        unsigned long frame;
+        bool changed;         // The view has to be composed again
+
+        TrailPyramid();
+        void create(SDL_Renderer *renderer);
+        TrailTile *find(int level, int x, int y);
+        TrailTile *rasterize(CompiledTree *tree, int level, int x, int y);
+        void add_new_points(Trail *trail);
+        void fade(float factor);
+        void clear();
+        bool compose(SDL_Renderer *renderer, CompiledTree *tree);
+        void free_members();
+};
+
 // * GLOBAL VARIABLES
 SDL_Window *window;
 SDL_Renderer *renderer;
 SDL_Texture *trail_texture;
 SDL_Event event;
+CompiledTree compiledTree;
+PhasorEvaluator phasorEvaluator;
+LineBatch trailBatch;
+CircleSprites circleSprites;
+TrailPyramid trailPyramid;
+
+// Transform from trail coordinates to the screen in animation mode, the identity unless zoomed or panned
+struct
+{
+    float zoom = 1;
+    Vec2Float offset;  // Screen position of the trail origin
+    Vec2Int last_mouse;
+} view;
+
+struct
+{
+    bool enabled;            // Rasterize trails in memory instead of on the trail_texture render target
+    Framebuffer framebuffer;
+    SDL_Texture *texture;    // Streaming texture the dirty rows of the framebuffer are uploaded to
+    float half_life;         // Seconds for trails to fade to half their brightness, 0 to never fade
+} cpuTrails;
+
+struct
+{
+    float max_segment_length = DEFAULT_MAX_SEGMENT_LENGTH; // Longest trail segment a single step may draw
+    float tolerance = DEFAULT_TOLERANCE; // Pixels rendered trails may stray from the curve when adaptively sampled or simplified, 0 for every point
+    double step;           // Fixed simulation step in seconds
+    double accumulator;    // Wall-clock time that has not been simulated yet
+    long long samples;     // Steps simulated since the animation started
+    long long closure_samples; // Step at which every trail has closed, -1 when the curve never closes
+    Vec2Float *buffer;     // Tip samples of one node for one frame
+} simulation;
 
 struct
 {
     int width, height;
     RGBA background_colour;
+    bool trails_lost; // The trail target lost its contents and has to be redrawn from the trail history
 } display;
 
+// Partial presentation for the software renderer drawing straight to the window surface. Layers are textures
+// under everything else and are only recomposited inside damaged rectangles, everything drawn over them is
+// recorded as an overlay and restored from the layers on the next frame
+struct
+{
+    bool enabled;
+    bool full = true;          // Redraw and present the whole screen, on the first frame and after mode switches
+    bool composited;           // Layers were composited this frame
+    DamageList restore;        // Stale pixels to restore from the layers this frame
+    DamageList overlays;       // Drawn over the layers this frame
+    DamageList previous;       // Overlays of the previous frame
+    DamageLayer layers[DAMAGE_MAX_LAYERS];
+    DamageLayer previous_layers[DAMAGE_MAX_LAYERS];
+    int layers_length, previous_layers_length;
+} damage;
+
 struct
 {
     Vec2Int pos, left_down_pos, left_up_pos, right_down_pos, right_up_pos;
@@ -155,6 +621,9 @@ struct KeyboardState
 
 struct EditorState {
     bool creating_first;
+    const char *scene_path;
+    const char *trails_path;      // Where the trails are exported to in animation mode
+    unsigned long scene_revision; // Incremented whenever an edit changes the curve
 
     enum {
         SET_CHILD_POSITION,
@@ -165,10 +634,14 @@ struct EditorState {
 
     EditorState() :
         creating_first(true),
+        scene_path("spirograph.scene"),
+        trails_path("trails.bmp"),
+        scene_revision(0),
         edit_mode(SET_CHILD_POSITION)
     {}
 };
 EditorState editorState;
+Preview preview;
 
 // * FUNCTION PROTOTYPES
 void edit(Spirograph *rootNode, double dt);
@@ -178,6 +651,29 @@ void node_near_cursor_orthproj(Spirograph *root, Spirograph **closest, float *di
 void colour_palette(Spirograph *current_node, bool *hovering);
 void change_rotation_speed(Spirograph *selected_node, bool *editing, double dt);
 
+// Simulation functions
+void start_simulation(Spirograph *root);
+void simulate(double dt);
+double fixed_step(CompiledTree *tree, PhasorEvaluator *evaluator, float max_segment_length, long long *closure_samples);
+void generate_curve(PhasorEvaluator *evaluator, int node, double dt, long long count, Vec2Float *out, int threads);
+long long adaptive_curve(PhasorEvaluator *evaluator, int node, double step, long long first, long long count, float tolerance, Vec2Float **points, long long *capacity);
+long long refine_curve(PhasorEvaluator *evaluator, int node, double step, long long first, long long count, float tolerance, Vec2Float **points, long long *capacity);
+long long merge_curve(Vec2Float *p, long long length, float tolerance);
+long long threaded_adaptive_curve(PhasorEvaluator *evaluator, int node, double step, long long count, float tolerance, Vec2Float **points, long long *capacity, int threads);
+
+// Sweep functions
+bool parse_sweep_axis(const char *text, SweepAxis *axis);
+int run_sweep(const char *scene_path, SweepAxis *axes, int axes_length, const char *out_dir, int threads);
+
+// Headless functions
+int run_headless(const char *scene_path, const char *out_path, int width, int height, int threads, enum ToneMap tone_map);
+bool parse_tone_map(const char *text, enum ToneMap *tone_map);
+int run_poster(const char *scene_path, const char *out_path, int width, int height, int threads);
+bool write_bmp_header(FILE *file, int width, int height);
+
+// Vec2 functions
+float segment_distance(Vec2Float point, Vec2Float a, Vec2Float b);
+
 // Colour functions
 RGBA hsva_to_rgba(HSVA in);
 HSVA rgba_to_hsva(RGBA in);
@@ -188,9 +684,34 @@ void quit_SDL();
 void handleEvents(bool *running, enum Mode *mode, Spirograph *root);
 void clearRenderer();
 
+// Damage tracking functions
+void damage_add(DamageList *list, SDL_Rect rect);
+void damage_restore(SDL_Rect rect);
+void damage_overlay(SDL_Rect rect);
+void damage_layer(SDL_Texture *texture, SDL_Rect rect, bool changed);
+void damage_composite();
+void present();
+
 // SDL Draw Functions
 int SDL_RenderDrawCircle(SDL_Renderer * renderer, int x, int y, int radius);
 int SDL_RenderFillCircle(SDL_Renderer *renderer, int x, int y, int radius);
 void drawLine(SDL_Renderer *renderer, RGBA colour, int x0, int y0, int x1, int y1);
+void draw_trails(CompiledTree *tree);
+
+// View functions
+bool view_transformed();
+Vec2Float view_to_screen(Vec2Float point);
+void update_view();
+void reset_view();
+void redraw_trails(CompiledTree *tree);
+bool export_trails(CompiledTree *tree, const char *path, float scale);
+void print_trail_history(CompiledTree *tree);
+template <typename Plot> void wu_line(float x0, float y0, float x1, float y1, const SDL_Rect *clip, Plot plot);
+template <typename Plot, typename Columns> void wu_line(float x0, float y0, float x1, float y1, const SDL_Rect *clip, Plot plot, Columns columns);
+template <typename Plot> void wu_columns(int first, int from, int last, float intery, float gradient, bool steep, Plot plot);
+template <typename Plot, typename Span> void stroke_segment(float x0, float y0, float x1, float y1, float width, const Vec2Float *previous, const SDL_Rect *clip, Plot plot, Span span);
+
+// Benchmark functions
+int run_bench();
 
 #endif
\ No newline at end of file
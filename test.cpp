@@ -0,0 +1,224 @@
+// Checks of behaviour that is hard to see by running the program, built and run by `make test`
+#define SDL_MAIN_HANDLED // The checks have their own main and never open a window
+#define main spirograph_main
+#include "spirograph.cpp"
+#undef main
+
+int failures = 0;
+
+void check(bool passed, const char *what)
+{
+    printf("%s: %s\n", passed ? "ok  " : "FAIL", what);
+    if (!passed) failures++;
+
+    return;
+}
+
+void animate(Spirograph *root, float half_life, double seconds)
+{
+    // Runs the animation the way the ANIMATE mode does, at 60 frames per second, with trails drawn in memory
+    cpuTrails.enabled = true;
+    cpuTrails.half_life = half_life;
+    cpuTrails.framebuffer.create(800, 600);
+    cpuTrails.framebuffer.clear({BLACK});
+    start_simulation(root);
+    double dt = 1 / 60.0;
+    for (double t = 0; t < seconds; t += dt)
+    {
+        simulate(dt);
+        if (cpuTrails.half_life > 0) cpuTrails.framebuffer.decay(pow(0.5, dt / cpuTrails.half_life));
+        for (int i = 0; i < compiledTree.nodes_length; i++)
+        {
+            if (compiledTree.trails[i]) compiledTree.trails[i]->draw();
+        }
+    }
+
+    return;
+}
+
+void check_fading_past_period()
+{
+    // One arm turning once a second, so the curve closes after a second
+    Spirograph root({400, 300}, {0, 0.1});
+    root.revps = 0;
+    root.is_root = true;
+    Spirograph *arm = new Spirograph({400, 300}, {500, 300});
+    root.add_child(arm);
+    arm->direction_initial = arm->direction = {100, 0};
+    arm->revps = 1;
+    arm->trail_on = true;
+
+    // Without fading the trail stops at the closed curve
+    animate(&root, 0, 3);
+    check(arm->trail->length == simulation.closure_samples + 1, "a persistent trail stops once the curve has closed");
+
+    // With fading it keeps being drawn, so the pixels under the tip are lit half way through the fourth period,
+    // long after the ones drawn there in the first period have faded out
+    arm->trail->reset();
+    animate(&root, 0.25f, 3.5);
+    check(arm->trail->length > 3 * simulation.closure_samples, "a fading trail keeps sampling past the period");
+    int node = 0;
+    while (compiledTree.trails[node] != arm->trail) node++;
+    Vec2Float tip = phasorEvaluator.tip(node, simulation.samples * simulation.step);
+    Uint8 *pixel = cpuTrails.framebuffer.pixels + ((size_t)floor(tip.y) * cpuTrails.framebuffer.width + (size_t)floor(tip.x)) * 4;
+    check(pixel[0] + pixel[1] + pixel[2] > 0, "a fading trail is still drawn under the tip after three periods");
+
+    compiledTree.free_members();
+    root.free_members();
+    return;
+}
+
+void add_three_arms(Spirograph *root)
+{
+    // Three arms at unrelated speeds, so the tip of the last one never repeats
+    Spirograph *arm = new Spirograph({400, 300}, {500, 300});
+    root->add_child(arm);
+    arm->direction_initial = arm->direction = {100, 0};
+    arm->revps = 0.37f;
+    Spirograph *forearm = new Spirograph({500, 300}, {560, 300});
+    arm->add_child(forearm);
+    forearm->direction_initial = forearm->direction = {60, 0};
+    forearm->revps = -1.93f;
+    Spirograph *hand = new Spirograph({560, 300}, {585, 300});
+    forearm->add_child(hand);
+    hand->direction_initial = hand->direction = {25, 0};
+    hand->revps = 7.11f;
+
+    return;
+}
+
+void check_tips_accuracy()
+{
+    Spirograph root({400, 300}, {0, 0.1});
+    root.revps = 0;
+    root.is_root = true;
+    add_three_arms(&root);
+
+    CompiledTree tree;
+    PhasorEvaluator evaluator;
+    tree.compile(&root);
+    evaluator.compile(&tree);
+
+    // Several blocks and a ragged end, so the recurrences are re-seeded a few times, far into the curve as well
+    const int count = 5 * PHASOR_BLOCK + 37;
+    Vec2Float *fast = (Vec2Float*)malloc(sizeof(Vec2Float) * count), *exact = (Vec2Float*)malloc(sizeof(Vec2Float) * count);
+    float deviation = 0;
+    for (long long first : {0LL, 1000000LL, 100000000LL})
+    {
+        evaluator.tips(tree.nodes_length - 1, 0, 1 / 600.0, first, count, fast);
+        evaluator.tips_reference(tree.nodes_length - 1, 0, 1 / 600.0, first, count, exact);
+        for (int k = 0; k < count; k++)
+        {
+            deviation = fmaxf(deviation, hypotf(fast[k].x - exact[k].x, fast[k].y - exact[k].y));
+        }
+    }
+    printf("      tips deviate at most %.5f px from the reference\n", deviation);
+    check(deviation < 0.01f, "the tips kernel matches the scalar reference");
+
+    free(fast);
+    free(exact);
+    evaluator.free_members();
+    tree.free_members();
+    root.free_members();
+    return;
+}
+
+void check_threaded_adaptive_curve()
+{
+    Spirograph root({400, 300}, {0, 0.1});
+    root.revps = 0;
+    root.is_root = true;
+    add_three_arms(&root);
+
+    CompiledTree tree;
+    PhasorEvaluator evaluator;
+    tree.compile(&root);
+    evaluator.compile(&tree);
+
+    // Refined on several threads and merged once, the curve must be the one sampled on a single thread
+    Vec2Float *single = NULL, *threaded = NULL;
+    long long single_capacity = 0, threaded_capacity = 0;
+    bool same = true;
+    for (float tolerance : {0.1f, 1.67f})
+    {
+        long long n = adaptive_curve(&evaluator, tree.nodes_length - 1, 0.001, 0, 100000, tolerance, &single, &single_capacity);
+        for (int threads : {2, 3, 8})
+        {
+            long long m = threaded_adaptive_curve(&evaluator, tree.nodes_length - 1, 0.001, 100000, tolerance, &threaded, &threaded_capacity, threads);
+            same = same && m == n && !memcmp(single, threaded, sizeof(Vec2Float) * n);
+        }
+    }
+    check(same, "adaptive curves sampled on several threads match a single thread");
+
+    free(single);
+    free(threaded);
+    evaluator.free_members();
+    tree.free_members();
+    root.free_members();
+    return;
+}
+
+void check_line_paths_match()
+{
+    // Framebuffer::draw_line does four columns at a time where it can and skips the ones outside it, it must draw
+    // exactly what wu_line does. Lines reach far past the edges
+    Framebuffer fast, exact;
+    fast.create(512, 512);
+    exact.create(512, 512);
+    fast.clear({BLACK});
+    exact.clear({BLACK});
+    srand(7);
+    auto random = [](float range) -> float {return range * rand() / (float)RAND_MAX;};
+    for (int i = 0; i < 2000; i++)
+    {
+        float x0 = random(3000) - 1000, y0 = random(3000) - 1000, x1 = random(3000) - 1000, y1 = random(3000) - 1000;
+        RGBA colour = {(float)(rand() % 256), (float)(rand() % 256), (float)(rand() % 256), 255};
+        fast.draw_line(colour, x0, y0, x1, y1);
+        wu_line(x0, y0, x1, y1, NULL, [&exact, colour](int x, int y, float coverage) -> void {
+            exact.blend(x, y, colour, coverage);
+            return;
+        });
+    }
+    check(!memcmp(fast.pixels, exact.pixels, sizeof(Uint8) * 4 * 512 * 512), "batched Wu lines match wu_line bit for bit");
+
+    fast.free_members();
+    exact.free_members();
+    return;
+}
+
+void check_stroke_density()
+{
+    // A wide stroke drawn as a row of one pixel segments, so every pixel is covered by several of them
+    DensityBuffer density;
+    density.create(200, 100);
+    density.clear();
+    for (int k = 1; k < 150; k++)
+    {
+        Vec2Float previous = {(float)(20 + k - 2), 50.3f};
+        density.draw_stroke({WHITE}, 20 + k - 1, 50.3f, 20 + k, 50.3f, 8, (k > 1) ? &previous : NULL, true);
+    }
+    float middle = 0, column = 0;
+    for (int y = 0; y < density.height; y++)
+    {
+        float coverage = density.cells[((size_t)y * density.width + 100) * 4 + 3];
+        if (coverage > middle) middle = coverage;
+        column += coverage;
+    }
+    check(fabsf(middle - 1) < 0.01f, "a wide stroke adds each pixel once");
+    check(fabsf(column - 8) < 0.05f, "a wide stroke adds its width across");
+
+    density.free_members();
+    return;
+}
+
+int main(int argc, char **argv)
+{
+    check_fading_past_period();
+    check_tips_accuracy();
+    check_threaded_adaptive_curve();
+    check_line_paths_match();
+    check_stroke_density();
+
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}